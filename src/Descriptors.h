@@ -42,6 +42,30 @@
 		#include <LUFA/Drivers/USB/USB.h>
 
 	/* Macros: */
+		/** HID Consumer Control interface next to the CDC ACM (media keys). */
+		#ifndef USB_HID_MEDIA
+			#define USB_HID_MEDIA              1
+		#endif
+
+		/** Second CDC ACM interface for the debug log, control and events keep the first one. */
+		#ifndef USB_CDC_LOG
+			#define USB_CDC_LOG                0
+		#endif
+
+		/* Both need endpoint 1, the ATmega32U4 has only six besides the control endpoint. */
+		#if USB_HID_MEDIA && USB_CDC_LOG
+			#error USB_HID_MEDIA and USB_CDC_LOG are mutually exclusive, there are not enough endpoints
+		#endif
+
+		/** Several functions: the device class is IAD and every CDC function gets an IAD. */
+		#define USB_COMPOSITE                  (USB_HID_MEDIA || USB_CDC_LOG)
+
+		/** Endpoint address of the HID media key report IN endpoint. */
+		#define MEDIA_IN_EPADDR                (ENDPOINT_DIR_IN  | 1)
+
+		/** Size in bytes of the HID media key report IN endpoint. */
+		#define MEDIA_EPSIZE                   8
+
 		/** Endpoint address of the CDC device-to-host notification IN endpoint. */
 		#define CDC_NOTIFICATION_EPADDR        (ENDPOINT_DIR_IN  | 2)
 
@@ -57,7 +81,22 @@
 		/** Size in bytes of the CDC data IN and OUT endpoints. */
 		#define CDC_TXRX_EPSIZE                16
 
+		/** Endpoint address of the log CDC device-to-host notification IN endpoint. */
+		#define LOG_NOTIFICATION_EPADDR        (ENDPOINT_DIR_IN  | 5)
+
+		/** Endpoint address of the log CDC device-to-host data IN endpoint. */
+		#define LOG_TX_EPADDR                  (ENDPOINT_DIR_IN  | 6)
+
+		/** Endpoint address of the log CDC host-to-device data OUT endpoint. */
+		#define LOG_RX_EPADDR                  (ENDPOINT_DIR_OUT | 1)
+
 	/* Type Defines: */
+		/** Media key report: one HID Consumer page usage, 0 when no key is pressed. */
+		typedef struct
+		{
+			uint16_t Usage;
+		} ATTR_PACKED USB_MediaReport_Data_t;
+
 		/** Type define for the device configuration descriptor structure. This must be defined in the
 		 *  application code, as the configuration descriptor contains several sub-descriptors which
 		 *  vary between devices, and which describe the device's usage to the host.
@@ -66,6 +105,11 @@
 		{
 			USB_Descriptor_Configuration_Header_t    Config;
 
+		#if USB_COMPOSITE
+			// CDC Interface Association
+			USB_Descriptor_Interface_Association_t   CDC_IAD;
+		#endif
+
 			// CDC Command Interface
 			USB_Descriptor_Interface_t               CDC_CCI_Interface;
 			USB_CDC_Descriptor_FunctionalHeader_t    CDC_Functional_Header;
@@ -77,6 +121,30 @@
 			USB_Descriptor_Interface_t               CDC_DCI_Interface;
 			USB_Descriptor_Endpoint_t                CDC_DataOutEndpoint;
 			USB_Descriptor_Endpoint_t                CDC_DataInEndpoint;
+
+		#if USB_CDC_LOG
+			// Log CDC Interface Association
+			USB_Descriptor_Interface_Association_t   LOG_IAD;
+
+			// Log CDC Command Interface
+			USB_Descriptor_Interface_t               LOG_CCI_Interface;
+			USB_CDC_Descriptor_FunctionalHeader_t    LOG_Functional_Header;
+			USB_CDC_Descriptor_FunctionalACM_t       LOG_Functional_ACM;
+			USB_CDC_Descriptor_FunctionalUnion_t     LOG_Functional_Union;
+			USB_Descriptor_Endpoint_t                LOG_NotificationEndpoint;
+
+			// Log CDC Data Interface
+			USB_Descriptor_Interface_t               LOG_DCI_Interface;
+			USB_Descriptor_Endpoint_t                LOG_DataOutEndpoint;
+			USB_Descriptor_Endpoint_t                LOG_DataInEndpoint;
+		#endif
+
+		#if USB_HID_MEDIA
+			// HID Consumer Control Interface
+			USB_Descriptor_Interface_t               HID_Interface;
+			USB_HID_Descriptor_HID_t                 HID_MediaHID;
+			USB_Descriptor_Endpoint_t                HID_ReportINEndpoint;
+		#endif
 		} USB_Descriptor_Configuration_t;
 
 		/** Enum for the device interface descriptor IDs within the device. Each interface descriptor
@@ -87,6 +155,14 @@
 		{
 			INTERFACE_ID_CDC_CCI = 0, /**< CDC CCI interface descriptor ID */
 			INTERFACE_ID_CDC_DCI = 1, /**< CDC DCI interface descriptor ID */
+		#if USB_CDC_LOG
+			INTERFACE_ID_LOG_CCI = 2, /**< Log CDC CCI interface descriptor ID */
+			INTERFACE_ID_LOG_DCI = 3, /**< Log CDC DCI interface descriptor ID */
+		#endif
+		#if USB_HID_MEDIA
+			INTERFACE_ID_Media   = 2, /**< HID Consumer Control interface descriptor ID */
+		#endif
+			INTERFACE_ID_COUNT,
 		};
 
 		/** Enum for the device string descriptor IDs within the device. Each string descriptor should
@@ -0,0 +1,138 @@
+#include <LUFA/Drivers/USB/USB.h>
+
+#include "cdc_tx.h"
+#include "log.h"
+
+typedef char cdc_tx_size_invalid[((CDC_TX_SIZE & (CDC_TX_SIZE - 1)) == 0) ? 1 : -1];
+typedef char cdc_tx_log_size_invalid[((CDC_TX_LOG_SIZE & (CDC_TX_LOG_SIZE - 1)) == 0) ? 1 : -1];
+
+/* Only the text log of a separate log interface may lose its oldest bytes */
+#define CDC_TX_CUT_OLDEST(ch) \
+	(CDC_TX_DROP_OLDEST && USB_CDC_LOG && !LOG_TRACE && ((ch) == CDC_TX_LOG))
+
+struct cdc_tx_ring {
+	uint8_t *ring;
+	uint16_t mask;  /* ring size - 1 */
+	uint16_t head;
+	uint16_t tail;
+	uint16_t dropped;
+};
+
+static uint8_t g_ctrl_ring[CDC_TX_SIZE];
+#if USB_CDC_LOG
+static uint8_t g_log_ring[CDC_TX_LOG_SIZE];
+#endif
+
+/* Main loop only, no locking (all empty at startup) */
+static struct cdc_tx_ring g_tx[CDC_TX_CHANNELS] = {
+	[CDC_TX_CTRL] = {
+		.ring = g_ctrl_ring,
+		.mask = CDC_TX_SIZE - 1,
+		.head = 0,
+		.tail = 0,
+		.dropped = 0,
+	},
+#if USB_CDC_LOG
+	[CDC_TX_LOG] = {
+		.ring = g_log_ring,
+		.mask = CDC_TX_LOG_SIZE - 1,
+		.head = 0,
+		.tail = 0,
+		.dropped = 0,
+	},
+#endif
+};
+
+/* Data IN endpoint of each channel */
+static const uint8_t cdc_tx_ep[CDC_TX_CHANNELS] = {
+	[CDC_TX_CTRL] = CDC_TX_EPADDR,
+#if USB_CDC_LOG
+	[CDC_TX_LOG]  = LOG_TX_EPADDR,
+#endif
+};
+
+static void cdc_tx_drop(struct cdc_tx_ring *tx, const uint16_t count);
+static void cdc_tx_move(struct cdc_tx_ring *tx, const uint8_t ep);
+
+static void cdc_tx_drop(struct cdc_tx_ring *tx, const uint16_t count)
+{
+	if (tx->dropped < (0xffff - count)) {
+		tx->dropped += count;
+	} else {
+		tx->dropped = 0xffff;
+	}
+}
+
+uint16_t cdc_tx_free(const uint8_t ch)
+{
+	return (g_tx[ch].tail - g_tx[ch].head - 1) & g_tx[ch].mask;
+}
+
+/* Write all bytes or none of them (binary packets are never cut) */
+int8_t cdc_tx_write(const uint8_t ch, const uint8_t *data, const uint16_t len)
+{
+	struct cdc_tx_ring *tx = &g_tx[ch];
+
+	if (len > tx->mask) {
+		cdc_tx_drop(tx, len);
+		return -ENOSPC;
+	}
+
+	if (cdc_tx_free(ch) < len) {
+		uint16_t count = len - cdc_tx_free(ch);
+
+		if (!CDC_TX_CUT_OLDEST(ch)) {
+			cdc_tx_drop(tx, len);
+			return -ENOSPC;
+		}
+		tx->tail = (tx->tail + count) & tx->mask;
+		cdc_tx_drop(tx, count);
+	}
+
+	for (uint16_t i = 0; i < len; ++i) {
+		tx->ring[tx->head] = data[i];
+		tx->head = (tx->head + 1) & tx->mask;
+	}
+
+	return 0;
+}
+
+/* Move buffered bytes into the IN endpoint as far as it has room */
+static void cdc_tx_move(struct cdc_tx_ring *tx, const uint8_t ep)
+{
+	if (tx->head == tx->tail) {
+		return;
+	}
+
+	Endpoint_SelectEndpoint(ep);
+
+	while ((tx->head != tx->tail) && Endpoint_IsINReady()) {
+		Endpoint_Write_8(tx->ring[tx->tail]);
+		tx->tail = (tx->tail + 1) & tx->mask;
+
+		/* Full bank goes out now, partial ones with CDC_Device_USBTask() */
+		if (Endpoint_BytesInEndpoint() >= CDC_TXRX_EPSIZE) {
+			Endpoint_ClearIN();
+		}
+	}
+}
+
+void cdc_tx_flush(void)
+{
+	uint8_t prev;
+
+	if (USB_DeviceState != DEVICE_STATE_Configured) {
+		return;
+	}
+
+	prev = Endpoint_GetCurrentEndpoint();
+	for (uint8_t ch = 0; ch < CDC_TX_CHANNELS; ++ch) {
+		cdc_tx_move(&g_tx[ch], cdc_tx_ep[ch]);
+	}
+	Endpoint_SelectEndpoint(prev);
+}
+
+uint16_t cdc_tx_dropped(const uint8_t ch)
+{
+	return g_tx[ch].dropped;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdint.h>
+#include "Descriptors.h"
+#include "error_codes.h"
+
+/* Non-blocking output to the CDC IN endpoints
+ *
+ * Logs, events and replies are written into a ring buffer and moved to
+ * the endpoint bank by cdc_tx_flush() from the main loop, whenever the
+ * bank is free. Nothing ever waits for the host. When the buffer is full
+ * the newest write is dropped and counted. Binary packets (replies, raw
+ * captures, log traces) are never cut: only a text log channel
+ * (USB_CDC_LOG without LOG_TRACE) can drop its oldest bytes instead, see
+ * CDC_TX_DROP_OLDEST.
+ *
+ * With USB_CDC_LOG the log has its own CDC interface and ring, so a burst
+ * of log output can't delay or drop events and replies. Otherwise both
+ * channels share the one ring.
+ */
+
+/*! Events, replies and raw packets */
+#define CDC_TX_CTRL 0
+/*! Debug log */
+#define CDC_TX_LOG (USB_CDC_LOG ? 1 : 0)
+#define CDC_TX_CHANNELS (1 + USB_CDC_LOG)
+
+/*! Ring buffer size of the control channel, power of two. Raw captures
+ *  need room for a whole packet (7 + 2 * 128 bytes). */
+#ifndef CDC_TX_SIZE
+# if IR_RAW_CAPTURE
+#  define CDC_TX_SIZE 512
+# else
+#  define CDC_TX_SIZE 128
+# endif
+#endif
+
+/*! Ring buffer size of the log channel (USB_CDC_LOG), power of two */
+#ifndef CDC_TX_LOG_SIZE
+# define CDC_TX_LOG_SIZE 128
+#endif
+
+/*! 1: a text log channel makes room by dropping the oldest bytes */
+#ifndef CDC_TX_DROP_OLDEST
+# define CDC_TX_DROP_OLDEST 0
+#endif
+
+int8_t cdc_tx_write(const uint8_t ch, const uint8_t *data, const uint16_t len);
+uint16_t cdc_tx_free(const uint8_t ch);
+void cdc_tx_flush(void);
+uint16_t cdc_tx_dropped(const uint8_t ch);
@@ -0,0 +1,52 @@
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "clock.h"
+
+static volatile uint16_t g_clock_high = 0;
+
+ISR(TIMER1_OVF_vect)
+{
+	++g_clock_high;
+}
+
+void clock_init(void)
+{
+	TCCR1A = 0x00; /* normal mode, TOP = 0xffff */
+	TCCR1B = 0x2;  /* clk/8 */
+	TIFR1 = (1 << TOV1);
+	TIMSK1 |= (1 << TOIE1);
+}
+
+/* Extend a 16 bit stamp taken a short while ago (interrupts disabled) */
+static uint32_t clock_extend_locked(const uint16_t stamp)
+{
+	uint16_t high = g_clock_high;
+
+	/* Overflow pending but not handled yet: low stamps belong after it */
+	if ((TIFR1 & (1 << TOV1)) && (stamp < 0x8000)) {
+		++high;
+	}
+	return ((uint32_t)high << 16) | stamp;
+}
+
+uint32_t clock_now(void)
+{
+	uint32_t now = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		now = clock_extend_locked(TCNT1);
+	}
+	return now;
+}
+
+uint32_t clock_extend(const uint16_t stamp)
+{
+	uint32_t ext = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ext = clock_extend_locked(stamp);
+	}
+	return ext;
+}
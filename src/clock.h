@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Free running time base on Timer 1 (clk/8, 0.5us at 16MHz)
+ *
+ * TCNT1 is never written, so input capture values, compare matches and
+ * clock_now() all share the same time line. The 16 bit counter is
+ * extended to 32 bits in software (wraps after ~35 minutes at 16MHz), use
+ * differences of timestamps only.
+ */
+
+/*! Timer 1 ticks per millisecond */
+#define CLOCK_TICKS_PER_MS (F_CPU / 8 / 1000)
+
+void clock_init(void);
+uint32_t clock_now(void);
+uint32_t clock_extend(const uint16_t stamp);
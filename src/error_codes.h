@@ -1,3 +1,7 @@
 #pragma once
 
 #define EBUSY 5
+#define ENOSPC 6
+#define ENOENT 7
+#define EINVAL 8
+#define EBADMSG 9
@@ -0,0 +1,87 @@
+#include <stddef.h>
+
+#include "clock.h"
+#include "evq.h"
+
+#define EVQ_MASK (EVQ_SIZE - 1)
+
+typedef char evq_size_not_power_of_two[((EVQ_SIZE & EVQ_MASK) == 0) ? 1 : -1];
+
+#define evq_barrier() __asm__ __volatile__ ("" ::: "memory")
+
+static struct {
+	struct event ring[EVQ_SIZE];
+	volatile uint8_t head; /* written by the producer only */
+	volatile uint8_t tail; /* written by the consumer only */
+	uint8_t lost;          /* producer: events not queued */
+} g_evq = {
+	.head = 0,
+	.tail = 0,
+	.lost = 0,
+};
+
+static uint8_t evq_put(const uint8_t type, const uint8_t arg, const uint32_t data);
+
+static uint8_t evq_put(const uint8_t type, const uint8_t arg, const uint32_t data)
+{
+	uint8_t head = g_evq.head;
+	uint8_t next = (head + 1) & EVQ_MASK;
+	struct event *ev;
+
+	if (next == g_evq.tail) {
+		return 0;
+	}
+
+	ev = &g_evq.ring[head];
+	ev->type = type;
+	ev->arg = arg;
+	ev->data = data;
+	ev->time = clock_now();
+	evq_barrier(); /* event must be complete before it is published */
+	g_evq.head = next;
+
+	return 1;
+}
+
+/* Post an event (ISR context only) */
+int8_t evq_post(const uint8_t type, const uint8_t arg, const uint32_t data)
+{
+	uint8_t free = (g_evq.tail - g_evq.head - 1) & EVQ_MASK;
+
+	if ((g_evq.lost > 0) && (free >= 2)) {
+		/* Report lost events first, ordered before the new one */
+		evq_put(EV_IR_OVERFLOW, g_evq.lost, 0);
+		g_evq.lost = 0;
+	}
+
+	if ((g_evq.lost == 0) && evq_put(type, arg, data)) {
+		return 0;
+	}
+
+	if (g_evq.lost < 0xff) {
+		++g_evq.lost;
+	}
+	return -ENOSPC;
+}
+
+/* Get the oldest event (main loop only), returns 0 if there is none */
+uint8_t evq_get(struct event *ev)
+{
+	uint8_t tail = g_evq.tail;
+
+	if (tail == g_evq.head) {
+		return 0;
+	}
+
+	*ev = g_evq.ring[tail];
+	evq_barrier(); /* copy event before the slot is released */
+	g_evq.tail = (tail + 1) & EVQ_MASK;
+
+	return 1;
+}
+
+/* Nothing to get (main loop, with interrupts disabled before sleeping) */
+uint8_t evq_empty(void)
+{
+	return (g_evq.tail == g_evq.head) ? 1 : 0;
+}
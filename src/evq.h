@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include "error_codes.h"
+
+/* Event queue from the ISRs to the main loop
+ *
+ * Single producer, single consumer: ISRs don't nest on AVR, so all of them
+ * together are the only producer and the main loop is the only consumer.
+ * Neither side has to disable interrupts.
+ */
+
+/*! Number of queued events, must be a power of two */
+#define EVQ_SIZE 16
+
+enum evq_type {
+	EV_NONE = 0,
+	EV_IR_FRAME,    /* arg: protocol, data: code */
+	EV_IR_REPEAT,   /* arg: protocol, data: code of the held key */
+	EV_IR_RAW,      /* arg: raw capture buffer */
+	EV_IR_OVERFLOW, /* arg: number of lost frames or events */
+	EV_TIMER,       /* arg: timer id */
+	EV_SPI_DONE,    /* arg: device, data: received bytes (first in bits 15..8) */
+};
+
+struct event {
+	uint8_t type;
+	uint8_t arg;
+	uint32_t data;
+	uint32_t time; /* clock_now() when the event was posted */
+};
+
+int8_t evq_post(const uint8_t type, const uint8_t arg, const uint32_t data);
+uint8_t evq_get(struct event *ev);
+uint8_t evq_empty(void);
@@ -0,0 +1,83 @@
+#include <avr/pgmspace.h>
+
+#include "fade.h"
+
+/* Smoothstep 3t^2 - 2t^3, 16 segments, 256 = 1 */
+static const uint16_t fade_scurve[17] PROGMEM = {
+	0, 3, 11, 24, 40, 59, 81, 104, 128, 152, 175, 197, 216, 232, 245, 253, 256,
+};
+
+static uint16_t fade_curve(const uint8_t curve, const uint16_t pos);
+
+/* Curve value (0..4096) at pos (0..4096) */
+static uint16_t fade_curve(const uint8_t curve, const uint16_t pos)
+{
+	uint16_t a;
+	uint16_t b;
+
+	if ((curve != FADE_SCURVE) || (pos >= 4096)) {
+		return pos;
+	}
+	/* Linear interpolation between the table entries */
+	a = pgm_read_word(&fade_scurve[pos >> 8]) << 4;
+	b = pgm_read_word(&fade_scurve[(pos >> 8) + 1]) << 4;
+	return a + (((uint32_t)(b - a) * (pos & 0xff)) >> 8);
+}
+
+/* Fade from the current level to to in ticks (0: jump there) */
+void fade_start(struct fade *f, const uint8_t to, const uint16_t ticks, const uint8_t curve)
+{
+	f->from = f->level;
+	f->to = to;
+	f->curve = (curve < FADE_CURVES) ? curve : FADE_LINEAR;
+	f->ticks = ticks;
+	f->step = 0;
+	if (ticks == 0) {
+		f->level = to;
+	}
+}
+
+/* New target. A running fade in the same direction goes on from the
+ * current level, linear and in the ticks given for the new distance: the
+ * caller keeps the rate, so a held key ramps instead of easing in again on
+ * every repeat. Anything else starts a new fade. */
+void fade_retarget(struct fade *f, const uint8_t to, const uint16_t ticks, const uint8_t curve)
+{
+	if ((f->step >= f->ticks) || ((to > f->level) != (f->to > f->level))) {
+		fade_start(f, to, ticks, curve);
+		return;
+	}
+	f->from = f->level;
+	f->to = to;
+	f->curve = FADE_LINEAR;
+	f->ticks = ticks;
+	f->step = 0;
+	if (ticks == 0) {
+		f->level = to;
+	}
+}
+
+/* Advance one tick, returns 1 if the level changed */
+uint8_t fade_tick(struct fade *f)
+{
+	uint8_t prev = f->level;
+	uint16_t pos;
+	int16_t delta = (int16_t)f->to - f->from;
+
+	if (f->step >= f->ticks) {
+		f->level = f->to;
+		return (f->level != prev) ? 1 : 0;
+	}
+
+	++f->step;
+	/* 12 bit position: a tick moves less than a code even on 255 codes */
+	pos = ((uint32_t)f->step << 12) / f->ticks;
+	f->level = f->from + (int16_t)(((int32_t)delta * fade_curve(f->curve, pos) + 2048) >> 12);
+
+	return (f->level != prev) ? 1 : 0;
+}
+
+uint8_t fade_running(const struct fade *f)
+{
+	return ((f->step < f->ticks) || (f->level != f->to)) ? 1 : 0;
+}
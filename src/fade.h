@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Gain fades
+ *
+ * A fade moves a level (PGA gain code, 0.5dB per step) from its current
+ * value to a target in a number of ticks, along a curve. The caller ticks
+ * it and writes the level; fade.c only does the arithmetic.
+ */
+
+/*! Constant dB per tick (PGA codes are linear in dB) */
+#define FADE_LINEAR 0
+/*! Slow start and end (smoothstep), no sudden change of slope */
+#define FADE_SCURVE 1
+#define FADE_CURVES 2
+
+struct fade {
+	uint8_t level;    /* current level */
+	uint8_t from;
+	uint8_t to;
+	uint8_t curve;
+	uint16_t ticks;   /* length of the fade */
+	uint16_t step;    /* ticks done, == ticks when finished */
+};
+
+void fade_start(struct fade *f, const uint8_t to, const uint16_t ticks, const uint8_t curve);
+void fade_retarget(struct fade *f, const uint8_t to, const uint16_t ticks, const uint8_t curve);
+uint8_t fade_tick(struct fade *f);
+uint8_t fade_running(const struct fade *f);
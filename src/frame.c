@@ -0,0 +1,93 @@
+#include <string.h>
+#include <util/crc16.h>
+
+#include "frame.h"
+#include "clock.h"
+
+static struct {
+	uint8_t n;      /* opcode + payload bytes, 0: no frame */
+	uint8_t pos;    /* bytes received after the length */
+	uint8_t crc;
+	uint32_t last;  /* clock_now() of the last byte */
+	struct frame f;
+} g_rx = {
+	.n = 0,
+};
+
+/* Does this byte start a binary frame? */
+uint8_t frame_start(const uint8_t byte)
+{
+	uint8_t n = byte & ~FRAME_START;
+
+	return ((byte & FRAME_START) && (n > 0) && (n <= FRAME_MAX)) ? 1 : 0;
+}
+
+/* Is a frame partially received? Payload bytes may look like a length
+ * byte, so a truncated frame is only detected by the time out. */
+uint8_t frame_busy(void)
+{
+	if ((g_rx.n != 0) &&
+	    ((clock_now() - g_rx.last) > (uint32_t)FRAME_TIMEOUT_MS * CLOCK_TICKS_PER_MS)) {
+		g_rx.n = 0;
+	}
+	return (g_rx.n != 0) ? 1 : 0;
+}
+
+/* Feed one byte (after frame_busy()), returns 1 when f holds a complete
+ * frame, -EBADMSG on a CRC error (f->seq is valid) and 0 otherwise */
+int8_t frame_feed(const uint8_t byte, struct frame *f)
+{
+	g_rx.last = clock_now();
+	if (g_rx.n == 0) {
+		if (!frame_start(byte)) {
+			return 0;
+		}
+		g_rx.n = byte & ~FRAME_START;
+		g_rx.pos = 0;
+		g_rx.crc = _crc8_ccitt_update(0, byte);
+		return 0;
+	}
+
+	if (g_rx.pos == g_rx.n + 1) {
+		/* CRC byte */
+		uint8_t ok = (byte == g_rx.crc);
+
+		g_rx.n = 0;
+		*f = g_rx.f;
+		return ok ? 1 : -EBADMSG;
+	}
+
+	g_rx.crc = _crc8_ccitt_update(g_rx.crc, byte);
+	if (g_rx.pos == 0) {
+		g_rx.f.seq = byte;
+	} else if (g_rx.pos == 1) {
+		g_rx.f.op = byte;
+		g_rx.f.len = 0;
+	} else {
+		g_rx.f.data[g_rx.f.len++] = byte;
+	}
+	++g_rx.pos;
+
+	return 0;
+}
+
+/* Build a frame in buf (len + FRAME_OVERHEAD + 1 bytes), returns its size */
+uint8_t frame_encode(uint8_t *buf, const uint8_t seq, const uint8_t op,
+                     const uint8_t *data, const uint8_t len)
+{
+	uint8_t size = 0;
+	uint8_t crc = 0;
+
+	buf[size++] = FRAME_START | (len + 1);
+	buf[size++] = seq;
+	buf[size++] = op;
+	memcpy(&buf[size], data, len);
+	size += len;
+
+	for (uint8_t i = 0; i < size; ++i) {
+		crc = _crc8_ccitt_update(crc, buf[i]);
+	}
+	buf[size++] = crc;
+
+	return size;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include "error_codes.h"
+
+/* Binary command frames (see doc/protocol.txt)
+ *
+ *   0x80 | n   n: opcode and payload bytes (1..FRAME_MAX)
+ *   seq        echoed in the reply
+ *   opcode
+ *   payload    n - 1 bytes
+ *   crc        CRC-8 (poly 0x07) of all bytes before
+ *
+ * ASCII commands never have the high bit set, so the first byte tells
+ * both apart.
+ */
+
+/*! Max. opcode + payload bytes of a frame */
+#define FRAME_MAX 8
+
+/*! Overhead of a frame: length, sequence number and CRC */
+#define FRAME_OVERHEAD 3
+
+#define FRAME_START 0x80
+
+/*! A partial frame is dropped when its next byte is this late */
+#define FRAME_TIMEOUT_MS 50
+
+struct frame {
+	uint8_t seq;
+	uint8_t op;
+	uint8_t len;                  /* payload bytes */
+	uint8_t data[FRAME_MAX - 1];
+};
+
+uint8_t frame_start(const uint8_t byte);
+uint8_t frame_busy(void);
+int8_t frame_feed(const uint8_t byte, struct frame *f);
+uint8_t frame_encode(uint8_t *buf, const uint8_t seq, const uint8_t op,
+                     const uint8_t *data, const uint8_t len);
@@ -0,0 +1,43 @@
+#pragma once
+
+/* Host build: the parts of LUFA that Descriptors.h and cdc_tx.c use. The
+ * endpoint functions are implemented by the test that links cdc_tx.c. */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define ATTR_PACKED __attribute__((packed))
+#define ATTR_WARN_UNUSED_RESULT
+#define ATTR_NON_NULL_PTR_ARG(...)
+
+#define ENDPOINT_DIR_IN  0x80
+#define ENDPOINT_DIR_OUT 0x00
+
+/* Descriptors are not built on the host, only their names are needed */
+typedef struct { uint8_t Size; uint8_t Type; } ATTR_PACKED USB_Descriptor_Header_t;
+typedef struct { USB_Descriptor_Header_t Header; } ATTR_PACKED USB_Descriptor_Configuration_Header_t;
+typedef struct { USB_Descriptor_Header_t Header; } ATTR_PACKED USB_Descriptor_Interface_t;
+typedef struct { USB_Descriptor_Header_t Header; } ATTR_PACKED USB_Descriptor_Interface_Association_t;
+typedef struct { USB_Descriptor_Header_t Header; } ATTR_PACKED USB_Descriptor_Endpoint_t;
+typedef struct { USB_Descriptor_Header_t Header; } ATTR_PACKED USB_CDC_Descriptor_FunctionalHeader_t;
+typedef struct { USB_Descriptor_Header_t Header; } ATTR_PACKED USB_CDC_Descriptor_FunctionalACM_t;
+typedef struct { USB_Descriptor_Header_t Header; } ATTR_PACKED USB_CDC_Descriptor_FunctionalUnion_t;
+typedef struct { USB_Descriptor_Header_t Header; } ATTR_PACKED USB_HID_Descriptor_HID_t;
+
+enum {
+	DEVICE_STATE_Unattached,
+	DEVICE_STATE_Powered,
+	DEVICE_STATE_Default,
+	DEVICE_STATE_Addressed,
+	DEVICE_STATE_Configured,
+	DEVICE_STATE_Suspended,
+};
+
+extern volatile uint8_t USB_DeviceState;
+
+uint8_t Endpoint_GetCurrentEndpoint(void);
+void Endpoint_SelectEndpoint(const uint8_t address);
+bool Endpoint_IsINReady(void);
+void Endpoint_Write_8(const uint8_t data);
+uint16_t Endpoint_BytesInEndpoint(void);
+void Endpoint_ClearIN(void);
@@ -0,0 +1,33 @@
+#pragma once
+
+/* Host build: EEPROM variables live in RAM (erased on every run) */
+
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM
+
+static inline uint8_t eeprom_read_byte(const uint8_t *p)
+{
+	return *p;
+}
+
+static inline uint32_t eeprom_read_dword(const uint32_t *p)
+{
+	return *p;
+}
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t n)
+{
+	memcpy(dst, src, n);
+}
+
+static inline uint8_t eeprom_is_ready(void)
+{
+	return 1;
+}
+
+static inline void eeprom_write_byte(uint8_t *p, uint8_t value)
+{
+	*p = value;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+/* Host build: flash tables are ordinary constants */
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+
+#define pgm_read_byte(p) (*(const uint8_t *)(p))
+#define pgm_read_word(p) (*(const uint16_t *)(p))
+#define pgm_read_dword(p) (*(const uint32_t *)(p))
+#define memcpy_P memcpy
+
+#define PGM_P const char *
+#define PSTR(s) (s)
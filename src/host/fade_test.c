@@ -0,0 +1,219 @@
+/* Host test of the gain fades (fade.c)
+ *
+ * Runs fades tick by tick like fade_step() in the firmware and checks the
+ * size of every step, the direction, retargeting while a fade is running
+ * and that every fade ends exactly on its target.
+ *
+ * Usage: fade_test [-v]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "fade.h"
+
+/* Ticks per code at the default rate: 250ms for 192 codes, 1ms ticks */
+#define RATE(codes) ((uint16_t)((uint32_t)(codes) * 250 / 192))
+
+static unsigned g_checks;
+static unsigned g_failed;
+static int g_verbose;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(const int ok, const char *what, const unsigned line)
+{
+	++g_checks;
+	if (!ok) {
+		++g_failed;
+	}
+	if (!ok || g_verbose) {
+		printf("fade_test.c:%u: %s %s\n", line, ok ? "ok" : "FAIL", what);
+	}
+}
+
+struct run {
+	unsigned ticks;     /* ticks until the fade stopped */
+	unsigned max_step;  /* largest change of one tick */
+	unsigned reversed;  /* steps against the direction of the fade */
+	unsigned outside;   /* levels outside from..to */
+};
+
+/* Tick until the fade ends (or limit ticks) */
+static void run(struct fade *f, const unsigned limit, struct run *r)
+{
+	uint8_t lo = (f->from < f->to) ? f->from : f->to;
+	uint8_t hi = (f->from < f->to) ? f->to : f->from;
+	uint8_t up = (f->to > f->from);
+
+	memset(r, 0, sizeof(*r));
+	while (fade_running(f) && (r->ticks < limit)) {
+		uint8_t prev = f->level;
+		unsigned step;
+
+		fade_tick(f);
+		++r->ticks;
+		step = (f->level > prev) ? (f->level - prev) : (prev - f->level);
+		if (step > r->max_step) {
+			r->max_step = step;
+		}
+		if ((f->level != prev) && ((f->level > prev) != up)) {
+			++r->reversed;
+		}
+		if ((f->level < lo) || (f->level > hi)) {
+			++r->outside;
+		}
+	}
+}
+
+static void test_linear(void)
+{
+	struct fade f = { .level = 0 };
+	struct run r;
+
+	/* Mute to 0dB: less than one code per tick */
+	fade_start(&f, 192, RATE(192), FADE_LINEAR);
+	run(&f, 1000, &r);
+	CHECK(r.ticks == RATE(192));
+	CHECK(r.max_step == 1);
+	CHECK((r.reversed == 0) && (r.outside == 0));
+	CHECK((f.level == 192) && !fade_running(&f));
+
+	/* Down over the whole range */
+	fade_start(&f, 0, RATE(255), FADE_LINEAR);
+	run(&f, 1000, &r);
+	CHECK(r.max_step == 1);
+	CHECK((r.reversed == 0) && (f.level == 0));
+
+	/* Linear in dB: equal steps, every tick moves by 1 at 1 tick/code */
+	fade_start(&f, 64, 64, FADE_LINEAR);
+	run(&f, 1000, &r);
+	CHECK((r.ticks == 64) && (r.max_step == 1) && (f.level == 64));
+
+	/* No ticks: jumps */
+	fade_start(&f, 10, 0, FADE_LINEAR);
+	CHECK((f.level == 10) && !fade_running(&f));
+	CHECK(fade_tick(&f) == 0);
+}
+
+static void test_scurve(void)
+{
+	struct fade f = { .level = 0 };
+	struct run r;
+	uint8_t quarter;
+
+	fade_start(&f, 192, RATE(192), FADE_SCURVE);
+	run(&f, RATE(192) / 4, &r);
+	quarter = f.level;
+	run(&f, 1000, &r);
+	/* Slow start: less than a quarter of the way after a quarter of the time */
+	CHECK(quarter < 192 / 4);
+	/* At most 1.5 times the linear slope: 1-2 codes per tick */
+	CHECK(r.max_step <= 2);
+	CHECK((r.reversed == 0) && (r.outside == 0));
+	CHECK((f.level == 192) && !fade_running(&f));
+
+	/* Mute from full gain */
+	f.level = 255;
+	fade_start(&f, 0, RATE(255), FADE_SCURVE);
+	run(&f, 1000, &r);
+	CHECK((r.max_step <= 2) && (r.reversed == 0));
+	CHECK((r.ticks == RATE(255)) && (f.level == 0));
+
+	/* Unknown curves fall back to linear */
+	fade_start(&f, 100, 100, FADE_CURVES);
+	CHECK(f.curve == FADE_LINEAR);
+}
+
+static void test_retarget(void)
+{
+	struct fade f = { .level = 0 };
+	struct run r;
+	uint8_t level;
+
+	/* Halfway through a fade up, the target moves further up */
+	fade_start(&f, 100, RATE(100), FADE_SCURVE);
+	run(&f, RATE(100) / 2, &r);
+	level = f.level;
+	CHECK(fade_running(&f));
+	fade_retarget(&f, 150, RATE(150 - level), FADE_SCURVE);
+	CHECK(f.level == level);
+	CHECK((f.from == level) && (f.to == 150));
+	/* Goes on at the rate, no new ease-in */
+	CHECK(f.curve == FADE_LINEAR);
+	run(&f, 1000, &r);
+	CHECK(r.ticks == RATE(150 - level));
+	CHECK((r.max_step == 1) && (r.reversed == 0));
+	CHECK((f.level == 150) && !fade_running(&f));
+
+	/* Held key, the target runs ahead: a constant rate, no staircase */
+	fade_start(&f, 20, 0, FADE_SCURVE);
+	for (unsigned target = 40; target <= 200; target += 20) {
+		uint8_t before;
+
+		fade_retarget(&f, target, RATE(target - f.level), FADE_SCURVE);
+		before = f.level;
+		run(&f, 20, &r);
+		CHECK((r.max_step <= 2) && (r.reversed == 0));
+		/* The first press eases in, then 20 ticks at 192 codes per 250 */
+		CHECK((target == 40) || ((f.level - before >= 15) && (f.level - before <= 16)));
+	}
+	run(&f, 1000, &r);
+	CHECK(f.level == 200);
+
+	/* Reversing direction starts a new fade */
+	fade_start(&f, 110, RATE(90), FADE_SCURVE);
+	run(&f, 20, &r);
+	level = f.level;
+	CHECK(fade_running(&f));
+	fade_retarget(&f, 0, RATE(level), FADE_SCURVE);
+	CHECK((f.from == level) && (f.curve == FADE_LINEAR));
+	fade_retarget(&f, 255, RATE(255 - level), FADE_SCURVE);
+	CHECK((f.from == level) && (f.curve == FADE_SCURVE));
+	run(&f, 1000, &r);
+	CHECK((r.reversed == 0) && (f.level == 255));
+
+	/* A finished fade starts a new one with the given curve */
+	fade_retarget(&f, 50, RATE(205), FADE_SCURVE);
+	CHECK((f.from == 255) && (f.curve == FADE_SCURVE) && (f.step == 0));
+}
+
+static void test_exact(void)
+{
+	static const uint8_t levels[] = { 0, 1, 7, 100, 191, 192, 193, 254, 255 };
+	static const uint16_t ticks[] = { 0, 1, 2, 3, 16, 250, 1000 };
+	unsigned bad = 0;
+
+	for (uint8_t curve = 0; curve < FADE_CURVES; ++curve) {
+		for (size_t a = 0; a < sizeof(levels); ++a) {
+			for (size_t b = 0; b < sizeof(levels); ++b) {
+				for (size_t t = 0; t < sizeof(ticks) / sizeof(ticks[0]); ++t) {
+					struct fade f = { .level = levels[a] };
+					struct run r;
+
+					fade_start(&f, levels[b], ticks[t], curve);
+					run(&f, 2000, &r);
+					if ((f.level != levels[b]) || fade_running(&f) ||
+					    (r.ticks != ticks[t]) || r.reversed || r.outside) {
+						++bad;
+					}
+				}
+			}
+		}
+	}
+	CHECK(bad == 0);
+}
+
+int main(int argc, char **argv)
+{
+	g_verbose = (argc > 1) && (strcmp(argv[1], "-v") == 0);
+
+	test_linear();
+	test_scurve();
+	test_retarget();
+	test_exact();
+
+	printf("fade: %u checks, %u failed\n", g_checks, g_failed);
+
+	return (g_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,198 @@
+/* Host test of the binary command frames (frame.c)
+ *
+ * Feeds encoded frames byte by byte through frame_busy() and frame_feed()
+ * like the CDC receive loop does. clock_now() is replaced by a counter
+ * that the test advances, so the resync after FRAME_TIMEOUT_MS is checked
+ * without waiting.
+ *
+ * Usage: frame_test [-v]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "frame.h"
+#include "clock.h"
+
+static uint32_t g_now;
+static unsigned g_checks;
+static unsigned g_failed;
+static int g_verbose;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(const int ok, const char *what, const unsigned line)
+{
+	++g_checks;
+	if (!ok) {
+		++g_failed;
+	}
+	if (!ok || g_verbose) {
+		printf("frame_test.c:%u: %s %s\n", line, ok ? "ok" : "FAIL", what);
+	}
+}
+
+uint32_t clock_now(void)
+{
+	return g_now;
+}
+
+static void wait_ms(const uint32_t ms)
+{
+	g_now += ms * CLOCK_TICKS_PER_MS;
+}
+
+/* Feed len bytes, 1ms apart. Returns the result of the last byte and the
+ * number of earlier bytes that did not return 0 in *early. */
+static int feed(const uint8_t *buf, const uint8_t len, struct frame *f, unsigned *early)
+{
+	int ret = 0;
+
+	*early = 0;
+	for (uint8_t i = 0; i < len; ++i) {
+		if ((i > 0) && !frame_busy()) {
+			++*early;
+		}
+		ret = frame_feed(buf[i], f);
+		if ((ret != 0) && (i + 1 < len)) {
+			++*early;
+		}
+		wait_ms(1);
+	}
+	return ret;
+}
+
+static void test_valid(void)
+{
+	const uint8_t data[] = { 0x12, 0x34, 0x56 };
+	uint8_t big[FRAME_MAX - 1];
+	uint8_t buf[FRAME_MAX + FRAME_OVERHEAD + 1];
+	struct frame f;
+	unsigned early;
+	uint8_t size;
+
+	size = frame_encode(buf, 0x42, 0x07, data, sizeof(data));
+	CHECK(size == sizeof(data) + FRAME_OVERHEAD + 1);
+	CHECK(frame_start(buf[0]));
+	CHECK(!frame_busy());
+	CHECK(feed(buf, size, &f, &early) == 1);
+	CHECK(early == 0);
+	CHECK(f.seq == 0x42);
+	CHECK(f.op == 0x07);
+	CHECK(f.len == sizeof(data));
+	CHECK(memcmp(f.data, data, sizeof(data)) == 0);
+	CHECK(!frame_busy());
+
+	/* Smallest frame, opcode only */
+	size = frame_encode(buf, 1, 0x7f, data, 0);
+	CHECK(feed(buf, size, &f, &early) == 1);
+	CHECK((f.op == 0x7f) && (f.len == 0) && (early == 0));
+
+	/* Largest frame */
+	memset(big, 0x5a, sizeof(big));
+	size = frame_encode(buf, 2, 0x01, big, sizeof(big));
+	CHECK(frame_start(buf[0]));
+	CHECK(feed(buf, size, &f, &early) == 1);
+	CHECK((f.len == FRAME_MAX - 1) && (memcmp(f.data, big, sizeof(big)) == 0));
+
+	/* ASCII bytes don't start a frame */
+	CHECK(!frame_start('V'));
+	CHECK(!frame_start(FRAME_START));
+	CHECK(!frame_start(FRAME_START | (FRAME_MAX + 1)));
+	CHECK(frame_feed('V', &f) == 0);
+	CHECK(!frame_busy());
+}
+
+static void test_bad_crc(void)
+{
+	const uint8_t data[] = { 0xaa };
+	uint8_t buf[FRAME_MAX + FRAME_OVERHEAD + 1];
+	struct frame f;
+	unsigned early;
+	uint8_t size;
+
+	size = frame_encode(buf, 0x10, 0x03, data, sizeof(data));
+	buf[size - 1] ^= 0x01;
+	CHECK(feed(buf, size, &f, &early) == -EBADMSG);
+	CHECK(early == 0);
+	CHECK(f.seq == 0x10);
+	CHECK(!frame_busy());
+
+	/* A corrupted payload byte fails the CRC as well */
+	size = frame_encode(buf, 0x11, 0x03, data, sizeof(data));
+	buf[3] ^= 0x80;
+	CHECK(feed(buf, size, &f, &early) == -EBADMSG);
+
+	/* The next good frame is received */
+	size = frame_encode(buf, 0x12, 0x03, data, sizeof(data));
+	CHECK(feed(buf, size, &f, &early) == 1);
+	CHECK(f.seq == 0x12);
+}
+
+static void test_truncated(void)
+{
+	const uint8_t data[] = { 0x01, 0x02, 0x03, 0x04 };
+	uint8_t buf[FRAME_MAX + FRAME_OVERHEAD + 1];
+	struct frame f;
+	unsigned early;
+	uint8_t size;
+
+	/* Half a frame, then a pause within the timeout: still busy */
+	size = frame_encode(buf, 0x20, 0x05, data, sizeof(data));
+	CHECK(feed(buf, size / 2, &f, &early) == 0);
+	wait_ms(FRAME_TIMEOUT_MS - 1);
+	CHECK(frame_busy());
+
+	/* Past the timeout the partial frame is dropped */
+	wait_ms(FRAME_TIMEOUT_MS);
+	CHECK(!frame_busy());
+
+	/* and the next frame starts cleanly */
+	size = frame_encode(buf, 0x21, 0x06, data, 2);
+	CHECK(feed(buf, size, &f, &early) == 1);
+	CHECK((f.seq == 0x21) && (f.op == 0x06) && (f.len == 2));
+
+	/* Without the pause the new frame is taken as the rest of the old one */
+	size = frame_encode(buf, 0x22, 0x05, data, sizeof(data));
+	CHECK(feed(buf, 3, &f, &early) == 0);
+	size = frame_encode(buf, 0x23, 0x06, data, 2);
+	CHECK(feed(buf, size, &f, &early) != 1);
+	CHECK(f.seq != 0x23);
+	wait_ms(FRAME_TIMEOUT_MS + 1);
+	CHECK(!frame_busy());
+	CHECK(feed(buf, size, &f, &early) == 1);
+	CHECK(f.seq == 0x23);
+}
+
+static void test_seq_wrap(void)
+{
+	uint8_t buf[FRAME_MAX + FRAME_OVERHEAD + 1];
+	struct frame f;
+	unsigned early;
+	uint8_t seq = 0xfd;
+
+	for (uint8_t i = 0; i < 6; ++i, ++seq) {
+		uint8_t size = frame_encode(buf, seq, 0x01, &seq, 1);
+
+		CHECK(feed(buf, size, &f, &early) == 1);
+		CHECK((f.seq == seq) && (f.data[0] == seq) && (early == 0));
+	}
+	CHECK(seq == 0x03);
+}
+
+int main(int argc, char **argv)
+{
+	g_verbose = (argc > 1) && (strcmp(argv[1], "-v") == 0);
+
+	/* Start close to the 32 bit wrap of the clock */
+	g_now = 0xffffffffUL - 100 * CLOCK_TICKS_PER_MS;
+
+	test_valid();
+	test_bad_crc();
+	test_truncated();
+	test_seq_wrap();
+
+	printf("frame: %u checks, %u failed\n", g_checks, g_failed);
+
+	return (g_failed == 0) ? 0 : 1;
+}
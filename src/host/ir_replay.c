@@ -0,0 +1,330 @@
+/* Replay recorded IR traces through the decoder and keymap
+ *
+ * Trace files contain frames, each one starts with a line
+ *
+ *   frame <expect> [<code> [<action>]]
+ *
+ * followed by the durations (Timer 1 ticks, 0.5us at 16MHz) of the frame,
+ * alternating mark and space and starting with a mark. <expect> is the
+ * protocol name, "repeat" or "none" (frame must not decode). The code is
+ * written like the firmware reports it (bytes in the order received).
+ * Lines starting with '#' are comments.
+ *
+ * Usage: ir_replay [-v] [-n iterations] trace...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ir_decode.h"
+#include "ir_keymap.h"
+
+#define EXPECT_REPEAT 0xfe
+#define EXPECT_NONE   0xfd
+#define NO_ACTION     0xff
+
+#define MAX_TICKS 512
+
+struct trace_frame {
+	const char *file;
+	unsigned line;
+	uint8_t expect;
+	uint8_t action;
+	uint32_t code;
+	uint16_t count;
+	uint16_t ticks[MAX_TICKS];
+};
+
+struct result {
+	uint8_t status;
+	uint8_t proto;
+	uint32_t code;
+};
+
+static const char *const proto_names[] = {
+	[IR_PROTO_NEC]     = "nec",
+	[IR_PROTO_SAMSUNG] = "samsung",
+	[IR_PROTO_SIRC]    = "sirc",
+	[IR_PROTO_RC6]     = "rc6",
+	[IR_PROTO_RC5]     = "rc5",
+};
+
+static const char *const action_names[IR_ACT_COUNT] = {
+	[IR_ACT_NONE]      = "none",
+	[IR_ACT_VOL_UP]    = "vol_up",
+	[IR_ACT_VOL_DOWN]  = "vol_down",
+	[IR_ACT_MUTE]      = "mute",
+	[IR_ACT_PRESET]    = "preset",
+	[IR_ACT_POWER_ON]  = "power_on",
+	[IR_ACT_POWER_OFF] = "power_off",
+	[IR_ACT_INPUT]     = "input",
+	[IR_ACT_MEDIA]     = "media",
+};
+
+#define ARRAY_SIZE(a) (sizeof(a) / sizeof((a)[0]))
+
+static struct trace_frame *g_frames = NULL;
+static size_t g_count = 0;
+static int g_verbose = 0;
+
+static int name_index(const char *const *names, const size_t n, const char *name)
+{
+	for (size_t i = 0; i < n; ++i) {
+		if ((names[i] != NULL) && (strcmp(names[i], name) == 0)) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+static uint32_t parse_code(const char *s)
+{
+	uint32_t code = 0;
+
+	/* First received byte first, see send_to_host() */
+	for (int i = 0; i < 4; ++i) {
+		unsigned byte = 0;
+
+		if (sscanf(s + 2 * i, "%2x", &byte) != 1) {
+			return 0;
+		}
+		code |= (uint32_t)byte << (8 * i);
+	}
+	return code;
+}
+
+static int parse_frame(struct trace_frame *f, char *line)
+{
+	char expect[16] = "";
+	char code[16] = "";
+	char action[16] = "";
+	int n = sscanf(line, "frame %15s %15s %15s", expect, code, action);
+	int proto;
+
+	if (n < 1) {
+		return -1;
+	}
+
+	f->action = NO_ACTION;
+	f->code = 0;
+	if (strcmp(expect, "repeat") == 0) {
+		f->expect = EXPECT_REPEAT;
+	} else if (strcmp(expect, "none") == 0) {
+		f->expect = EXPECT_NONE;
+	} else if ((proto = name_index(proto_names, ARRAY_SIZE(proto_names), expect)) >= 0) {
+		f->expect = (uint8_t)proto;
+		if (n < 2) {
+			return -1;
+		}
+		f->code = parse_code(code);
+	} else {
+		return -1;
+	}
+
+	if (n == 3) {
+		int act = name_index(action_names, ARRAY_SIZE(action_names), action);
+
+		if (act < 0) {
+			return -1;
+		}
+		f->action = (uint8_t)act;
+	}
+	return 0;
+}
+
+static int load(const char *file)
+{
+	FILE *fp = fopen(file, "r");
+	char line[1024];
+	unsigned lineno = 0;
+	struct trace_frame *f = NULL;
+
+	if (fp == NULL) {
+		perror(file);
+		return -1;
+	}
+
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		char *p = line;
+
+		++lineno;
+		if ((line[0] == '#') || (line[0] == '\n')) {
+			continue;
+		}
+
+		if (strncmp(line, "frame", 5) == 0) {
+			g_frames = realloc(g_frames, (g_count + 1) * sizeof(*g_frames));
+			f = &g_frames[g_count++];
+			memset(f, 0, sizeof(*f));
+			f->file = file;
+			f->line = lineno;
+			if (parse_frame(f, line) != 0) {
+				fprintf(stderr, "%s:%u: invalid frame line\n", file, lineno);
+				fclose(fp);
+				return -1;
+			}
+			continue;
+		}
+
+		while (f != NULL) {
+			char *end;
+			unsigned long ticks = strtoul(p, &end, 10);
+
+			if (end == p) {
+				break;
+			}
+			if ((ticks > 0xffff) || (f->count >= MAX_TICKS)) {
+				fprintf(stderr, "%s:%u: invalid duration\n", file, lineno);
+				fclose(fp);
+				return -1;
+			}
+			f->ticks[f->count++] = (uint16_t)ticks;
+			p = end;
+		}
+	}
+
+	fclose(fp);
+	return 0;
+}
+
+/* Feed one frame like the capture ISR does: stop at the first result */
+static void decode(const struct trace_frame *f, struct result *r)
+{
+	r->status = IR_DECODE_BUSY;
+	ir_decode_reset();
+
+	for (uint16_t i = 0; i < f->count; ++i) {
+		uint8_t level = (i & 1) ? IR_SPACE : IR_MARK;
+
+		r->status = ir_decode_edge(level, f->ticks[i]);
+		if (r->status != IR_DECODE_BUSY) {
+			break;
+		}
+	}
+
+	r->proto = ir_decode_proto();
+	r->code = ir_decode_code();
+}
+
+static int check(const struct trace_frame *f, const struct result *r)
+{
+	struct ir_key key;
+
+	switch (f->expect) {
+	case EXPECT_NONE:
+		return (r->status != IR_DECODE_DONE) && (r->status != IR_DECODE_REPEAT);
+	case EXPECT_REPEAT:
+		return r->status == IR_DECODE_REPEAT;
+	default:
+		break;
+	}
+
+	if ((r->status != IR_DECODE_DONE) || (r->proto != f->expect) ||
+	    (r->code != f->code)) {
+		return 0;
+	}
+	if (f->action != NO_ACTION) {
+		if (!ir_keymap_lookup(r->code, r->proto, &key)) {
+			key.action = IR_ACT_NONE;
+		}
+		return key.action == f->action;
+	}
+	return 1;
+}
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void bench(const unsigned long iterations)
+{
+	struct result r;
+	struct ir_key key;
+	unsigned long edges = 0;
+	volatile uint32_t sink = 0;
+	double start;
+	double decode_ns;
+	double lookup_ns;
+
+	for (size_t i = 0; i < g_count; ++i) {
+		edges += g_frames[i].count;
+	}
+
+	start = now_ns();
+	for (unsigned long n = 0; n < iterations; ++n) {
+		for (size_t i = 0; i < g_count; ++i) {
+			decode(&g_frames[i], &r);
+			sink += r.code;
+		}
+	}
+	decode_ns = (now_ns() - start) / iterations;
+
+	start = now_ns();
+	for (unsigned long n = 0; n < iterations; ++n) {
+		for (size_t i = 0; i < g_count; ++i) {
+			sink += ir_keymap_lookup(g_frames[i].code, g_frames[i].expect, &key);
+		}
+	}
+	lookup_ns = (now_ns() - start) / iterations;
+
+	printf("decode: %.1f ns/frame, %.2f ns/edge\n",
+	       decode_ns / g_count, decode_ns / edges);
+	printf("lookup: %.1f ns/frame\n", lookup_ns / g_count);
+	(void)sink;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long iterations = 0;
+	size_t failed = 0;
+	int i;
+
+	for (i = 1; i < argc; ++i) {
+		if (strcmp(argv[i], "-v") == 0) {
+			g_verbose = 1;
+		} else if ((strcmp(argv[i], "-n") == 0) && (i + 1 < argc)) {
+			iterations = strtoul(argv[++i], NULL, 0);
+		} else if (load(argv[i]) != 0) {
+			return 2;
+		}
+	}
+
+	if (g_count == 0) {
+		fprintf(stderr, "usage: %s [-v] [-n iterations] trace...\n", argv[0]);
+		return 2;
+	}
+
+	ir_keymap_init();
+
+	for (size_t n = 0; n < g_count; ++n) {
+		const struct trace_frame *f = &g_frames[n];
+		struct result r;
+		int ok;
+
+		decode(f, &r);
+		ok = check(f, &r);
+		if (!ok) {
+			++failed;
+		}
+		if (!ok || g_verbose) {
+			printf("%s:%u: %s status=%u proto=%u code=%08lx\n",
+			       f->file, f->line, ok ? "ok" : "FAIL",
+			       r.status, r.proto, (unsigned long)r.code);
+		}
+	}
+
+	printf("%zu frames, %zu failed, accuracy %.1f%%\n",
+	       g_count, failed, 100.0 * (g_count - failed) / g_count);
+
+	if (iterations > 0) {
+		bench(iterations);
+	}
+
+	return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+"""Turn the CDC output of a LOGTRACE=1 build back into text.
+
+Trace packets (doc/raw.txt) carry the flash address of the format string
+and the raw arguments; the format strings are read from the Intel HEX image
+of the same build. Everything outside packets is passed through unchanged.
+
+  host/log_decode.py ir_arduino.hex < /dev/ttyACM0
+"""
+
+import re
+import struct
+import sys
+
+CONV = re.compile(rb"%(0?)(\d*)(hh|h|l)?([duxXcs%])")
+
+
+def load_hex(path):
+    """Intel HEX -> {address: byte}"""
+    image = {}
+    base = 0
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith(":"):
+                continue
+            rec = bytes.fromhex(line[1:])
+            count, addr, kind = rec[0], (rec[1] << 8) | rec[2], rec[3]
+            data = rec[4:4 + count]
+            if kind == 0:
+                for i, b in enumerate(data):
+                    image[base + addr + i] = b
+            elif kind == 2:
+                base = ((data[0] << 8) | data[1]) << 4
+            elif kind == 4:
+                base = ((data[0] << 8) | data[1]) << 16
+    return image
+
+
+def read_string(image, addr):
+    out = bytearray()
+    while image.get(addr, 0) != 0:
+        out.append(image[addr])
+        addr += 1
+    return bytes(out)
+
+
+def format_trace(fmt, args):
+    """Format like log_format() in log.c, taking the arguments from args"""
+    out = bytearray()
+    pos = 0
+    for m in CONV.finditer(fmt):
+        out += fmt[pos:m.start()]
+        pos = m.end()
+        zero, width, length, conv = m.groups()
+        if conv == b"%":
+            out += b"%"
+            continue
+        if conv == b"s":
+            end = args.index(0)
+            out += args[:end]
+            args = args[end + 1:]
+            continue
+        size = {b"hh": 1, b"l": 4}.get(length, 2)
+        if conv == b"c":
+            size = 1
+        value = int.from_bytes(args[:size], "little")
+        args = args[size:]
+        if conv == b"c":
+            out.append(value & 0xff)
+            continue
+        if conv == b"d" and value & (1 << (size * 8 - 1)):
+            value -= 1 << (size * 8)
+        spec = "%" + zero.decode() + width.decode() + \
+               {b"d": "d", b"u": "d", b"x": "x", b"X": "X"}[conv]
+        out += (spec % value).encode()
+    out += fmt[pos:]
+    return bytes(out)
+
+
+def decode(image, data, out):
+    """Write what can be decoded, return the incomplete packet at the end"""
+    pos = 0
+    while True:
+        start = data.find(b"\x00", pos)
+        if start < 0:
+            out.write(data[pos:])
+            return b""
+        out.write(data[pos:start])
+        if len(data) - start < 4:
+            return data[start:]
+        kind = data[start + 1:start + 2]
+        length = struct.unpack_from("<H", data, start + 2)[0]
+        if len(data) - start < 4 + length:
+            return data[start:]
+        payload = data[start + 4:start + 4 + length]
+        pos = start + 4 + length
+        if kind != b"T" or length < 2:
+            continue  # raw capture packets etc.
+        fmt = read_string(image, struct.unpack_from("<H", payload)[0])
+        try:
+            out.write(format_trace(fmt, payload[2:]))
+        except (IndexError, ValueError):
+            out.write(b"<bad trace %s>\r\n" % payload.hex().encode())
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(__doc__)
+    image = load_hex(sys.argv[1])
+    pending = b""
+    while True:
+        chunk = sys.stdin.buffer.read1(256)
+        if not chunk:
+            break
+        pending = decode(image, pending + chunk, sys.stdout.buffer)
+        sys.stdout.buffer.flush()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,240 @@
+/* Host test of the PROGMEM logger (log.c) and the CDC TX ring (cdc_tx.c)
+ *
+ * The IN endpoint is a buffer in this test: cdc_tx_flush() moves the ring
+ * into it as the firmware does into the endpoint bank, so every check
+ * sees exactly the bytes the host would receive. Build with
+ * -DLOG_TRACE=1 to check the binary trace packets instead of text.
+ *
+ * Usage: log_test [-v]
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "cdc_tx.h"
+#include "log.h"
+
+static struct {
+	uint8_t data[1024];
+	uint16_t len;
+	uint16_t bank;      /* bytes in the current bank */
+	uint8_t ready;      /* 0: the host doesn't read */
+} g_in;
+
+static unsigned g_checks;
+static unsigned g_failed;
+static int g_verbose;
+
+volatile uint8_t USB_DeviceState = DEVICE_STATE_Configured;
+
+uint8_t Endpoint_GetCurrentEndpoint(void)
+{
+	return 0;
+}
+
+void Endpoint_SelectEndpoint(const uint8_t address)
+{
+	(void)address;
+}
+
+bool Endpoint_IsINReady(void)
+{
+	return g_in.ready && (g_in.len < sizeof(g_in.data));
+}
+
+void Endpoint_Write_8(const uint8_t data)
+{
+	g_in.data[g_in.len++] = data;
+	++g_in.bank;
+}
+
+uint16_t Endpoint_BytesInEndpoint(void)
+{
+	return g_in.bank;
+}
+
+void Endpoint_ClearIN(void)
+{
+	g_in.bank = 0;
+}
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(const int ok, const char *what, const unsigned line)
+{
+	++g_checks;
+	if (!ok) {
+		++g_failed;
+	}
+	if (!ok || g_verbose) {
+		printf("log_test.c:%u: %s %s\n", line, ok ? "ok" : "FAIL", what);
+	}
+}
+
+/* Everything the ring holds, as the host receives it */
+static uint16_t received(void)
+{
+	g_in.len = 0;
+	g_in.bank = 0;
+	g_in.ready = 1;
+	cdc_tx_flush();
+	g_in.ready = 0;
+	return g_in.len;
+}
+
+#if LOG_TRACE
+/* Trace packet: 0x00 'T' len 0, format id, arguments */
+static int is_trace(PGM_P fmt, const uint8_t *args, const uint8_t len)
+{
+	uint16_t id = (uint16_t)(uintptr_t)fmt;
+	const uint8_t head[] = { 0x00, 'T', len + 2, 0, id & 0xff, id >> 8 };
+	uint16_t n = received();
+
+	if (g_verbose) {
+		printf("  %u bytes\n", n);
+	}
+	return (n == sizeof(head) + len) &&
+	       (memcmp(g_in.data, head, sizeof(head)) == 0) &&
+	       (memcmp(&g_in.data[sizeof(head)], args, len) == 0);
+}
+
+#define TRACE(args, fmt, ...) \
+	do { \
+		static const char f[] = fmt; \
+		log_P(f, __VA_ARGS__); \
+		CHECK(is_trace(f, (const uint8_t *)args, sizeof(args) - 1)); \
+	} while (0)
+
+static void test_trace(void)
+{
+	TRACE("", "plain %%", 0);
+	TRACE("\x85\xff", "%d", -123);
+	TRACE("\xe8\x03", "%u", 1000);
+	TRACE("\x2a", "%hhu", 0x12a);
+	TRACE("\x78\x56\x34\x12", "%lx", 0x12345678UL);
+	TRACE("ab\0", "%s", "ab");
+	TRACE("\x01\x00" "x" "\x02\x00", "%u %c %04X", 1, 'x', 2);
+}
+#else
+static int is_text(const char *expect)
+{
+	uint16_t n = received();
+
+	g_in.data[n] = '\0';
+	if (g_verbose) {
+		printf("  \"%s\"\n", (const char *)g_in.data);
+	}
+	return (n == strlen(expect)) && (memcmp(g_in.data, expect, n) == 0);
+}
+
+#define TEXT(expect, fmt, ...) \
+	do { \
+		log_P(PSTR(fmt), ##__VA_ARGS__); \
+		CHECK(is_text(expect)); \
+	} while (0)
+
+static void test_conversions(void)
+{
+	TEXT("plain", "plain");
+	TEXT("0 -1 32767 -32768", "%d %d %d %d", 0, -1, 32767, -32768);
+	TEXT("65535 40000", "%u %u", 65535, 40000);
+	TEXT("ff 1A2B", "%x %X", 0xff, 0x1a2b);
+	TEXT("-5 251", "%hhd %hhu", -5, 0xfb);
+	TEXT("1234 -7", "%hd %hd", 1234, -7);
+	TEXT("4294967295 -2147483648", "%lu %ld", 0xffffffffUL, (long)(-2147483647L - 1));
+	TEXT("deadbeef", "%lx", 0xdeadbeefUL);
+	TEXT("[  42][0042][ -42][-042]", "[%4u][%04u][%4d][%04d]", 42, 42, -42, -42);
+	TEXT("[0a]", "[%02hhx]", 0x0a);
+	TEXT("c=x s=abc 100%", "c=%c s=%s 100%%", 'x', "abc");
+	TEXT("%q", "%q");
+	TEXT("end", "end%");
+}
+
+static void test_line_max(void)
+{
+	char expect[LOG_LINE_MAX + 1];
+
+	memset(expect, 'x', LOG_LINE_MAX);
+	expect[LOG_LINE_MAX] = '\0';
+
+	/* Longer messages are cut at LOG_LINE_MAX */
+	log_P(PSTR("%s%s"), expect, "yyyy");
+	CHECK(is_text(expect));
+	log_P(PSTR("%s%u"), expect, 12345);
+	CHECK(is_text(expect));
+}
+#endif
+
+/* A full ring drops whole messages and counts their bytes */
+static void test_drop(void)
+{
+	uint16_t before = cdc_tx_dropped(CDC_TX_LOG);
+	uint16_t kept = 0;
+	uint16_t n;
+
+	(void)received();
+	CHECK(cdc_tx_free(CDC_TX_LOG) == CDC_TX_SIZE - 1);
+
+	/* 9 bytes each (text) or 8 (trace), the ring holds no whole number of them */
+	for (uint8_t i = 0; i < (CDC_TX_SIZE / 8) + 2; ++i) {
+		uint16_t free = cdc_tx_free(CDC_TX_LOG);
+
+		log_P(PSTR("msg %03u\r\n"), i);
+		if (cdc_tx_free(CDC_TX_LOG) != free) {
+			kept += free - cdc_tx_free(CDC_TX_LOG);
+		}
+	}
+	n = cdc_tx_dropped(CDC_TX_LOG) - before;
+	CHECK(n > 0);
+	CHECK(kept + cdc_tx_free(CDC_TX_LOG) == CDC_TX_SIZE - 1);
+	CHECK(received() == kept);
+#if !LOG_TRACE
+	CHECK(kept % 9 == 0);
+	CHECK(memcmp(&g_in.data[kept - 9], "msg ", 4) == 0);
+	CHECK(g_in.data[kept - 1] == '\n');
+#else
+	CHECK(kept % 8 == 0);
+	CHECK((g_in.data[kept - 8] == 0x00) && (g_in.data[kept - 7] == 'T'));
+#endif
+
+	/* Once the host has read the ring, messages fit again */
+	log_P(PSTR("msg %03u\r\n"), 1);
+	CHECK((uint16_t)(cdc_tx_dropped(CDC_TX_LOG) - before) == n);
+	CHECK(received() > 0);
+
+	/* A write larger than the ring is dropped too, never cut */
+	{
+		uint8_t big[CDC_TX_SIZE];
+
+		memset(big, 'z', sizeof(big));
+		CHECK(cdc_tx_write(CDC_TX_CTRL, big, sizeof(big)) == -ENOSPC);
+		CHECK((uint16_t)(cdc_tx_dropped(CDC_TX_CTRL) - before) == n + CDC_TX_SIZE);
+		CHECK(received() == 0);
+	}
+
+	/* The counter saturates instead of wrapping */
+	for (uint16_t i = 0; i < 600; ++i) {
+		uint8_t big[CDC_TX_SIZE];
+
+		cdc_tx_write(CDC_TX_CTRL, big, sizeof(big));
+	}
+	CHECK(cdc_tx_dropped(CDC_TX_CTRL) == 0xffff);
+}
+
+int main(int argc, char **argv)
+{
+	g_verbose = (argc > 1) && (strcmp(argv[1], "-v") == 0);
+
+#if LOG_TRACE
+	test_trace();
+#else
+	test_conversions();
+	test_line_max();
+#endif
+	test_drop();
+
+	printf("log%s: %u checks, %u failed\n", LOG_TRACE ? " trace" : "",
+	       g_checks, g_failed);
+
+	return (g_failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,162 @@
+#!/usr/bin/env python3
+"""Synthesize the replay traces in traces/ (durations in Timer 1 ticks).
+
+Frames are generated from the protocol timings, then distorted the way real
+receivers and remotes do: resonator drift scales all durations, the receiver
+AGC stretches marks and shortens spaces by the same amount and every edge
+has some jitter. Captures from raw mode (doc/raw.txt) can be appended to the
+trace files in the same format.
+"""
+
+import random
+
+TICKS_PER_US = 2  # clk/8 at 16MHz
+
+
+def merge(levels):
+    """(level, us) pairs -> durations starting with a mark, no final space"""
+    out = []
+    last = None
+    for level, us in levels:
+        if level == last:
+            out[-1] += us
+        else:
+            if not out and level == 0:
+                continue  # idle line before the first mark
+            out.append(us)
+            last = level
+    if last == 0:
+        out.pop()  # the timeout ends the frame, not an edge
+    return out
+
+
+def code_bytes(code):
+    return [(code >> (8 * i)) & 0xff for i in range(4)]
+
+
+def nec(code, hdr_mark=9000):
+    lv = [(1, hdr_mark), (0, 4500)]
+    for i in range(32):
+        lv += [(1, 560), (0, 1690 if (code >> i) & 1 else 560)]
+    lv += [(1, 560)]
+    return merge(lv)
+
+
+def nec_repeat():
+    return merge([(1, 9000), (0, 2250), (1, 560)])
+
+
+def sirc(code, bits=12):
+    lv = [(1, 2400), (0, 600)]
+    for i in range(bits):
+        lv += [(1, 1200 if (code >> i) & 1 else 600), (0, 600)]
+    return merge(lv)
+
+
+def rc5(code):
+    lv = []
+    for i in range(13, -1, -1):
+        if (code >> i) & 1:
+            lv += [(0, 889), (1, 889)]
+        else:
+            lv += [(1, 889), (0, 889)]
+    return merge(lv)
+
+
+def rc6(code):
+    lv = [(1, 2666), (0, 889)]
+    for i in range(20, -1, -1):
+        w = 889 if i == 16 else 444
+        if (code >> i) & 1:
+            lv += [(1, w), (0, w)]
+        else:
+            lv += [(0, w), (1, w)]
+    return merge(lv)
+
+
+def distort(durations, rng, drift=1.0, stretch=0, jitter=0.0):
+    out = []
+    for i, us in enumerate(durations):
+        us = us * drift + (stretch if i % 2 == 0 else -stretch)
+        us *= 1.0 + rng.uniform(-jitter, jitter)
+        out.append(max(1, int(round(us * TICKS_PER_US))))
+    return out
+
+
+def ticks(durations):
+    return [us * TICKS_PER_US for us in durations]
+
+
+def code_str(code):
+    return ''.join('%02x' % b for b in code_bytes(code))
+
+
+def le_code(b0, b1, b2, b3):
+    return b0 | (b1 << 8) | (b2 << 16) | (b3 << 24)
+
+
+NEC_KEYS = [
+    (le_code(0xa6, 0x59, 0x0a, 0xf5), 'vol_up'),
+    (le_code(0xa6, 0x59, 0x0b, 0xf4), 'vol_down'),
+    (le_code(0xa4, 0x5b, 0x1e, 0xe1), 'mute'),
+    (le_code(0xa6, 0x59, 0xd8, 0x27), 'preset'),
+    (le_code(0xa6, 0x59, 0x4c, 0xb3), 'input'),
+    (le_code(0x00, 0xff, 0x45, 0xba), 'none'),
+]
+
+
+def frames(rng):
+    """(expect line, durations in us) of every protocol"""
+    for code, action in NEC_KEYS:
+        yield 'nec %s %s' % (code_str(code), action), nec(code)
+    for code in (le_code(0x07, 0x07, 0x02, 0xfd), le_code(0xe0, 0xe0, 0x40, 0xbf)):
+        yield 'samsung %s' % code_str(code), nec(code, hdr_mark=4500)
+    for code in (0x095, 0xa93, 0x290):
+        yield 'sirc %s' % code_str(code), sirc(code)
+    for code in (0x3001, 0x3835, 0x37ff, 0x3000):
+        yield 'rc5 %s' % code_str(code & ~0x800), rc5(code)
+    for code in (0x10000c, 0x11000c, 0x10ffff, 0x100000):
+        yield 'rc6 %s' % code_str(code & ~0x10000), rc6(code)
+
+
+def write(name, header, entries):
+    with open('traces/%s.txt' % name, 'w') as fp:
+        fp.write('# %s\n# generated by mktraces.py\n' % header)
+        for expect, t in entries:
+            fp.write('\nframe %s\n' % expect)
+            for i in range(0, len(t), 16):
+                fp.write(' '.join(str(x) for x in t[i:i + 16]) + '\n')
+
+
+def main():
+    rng = random.Random(1)
+
+    write('clean', 'nominal timings of all protocols',
+          [(e, ticks(d)) for e, d in frames(rng)])
+
+    noisy = []
+    for drift, stretch, jitter in ((1.0, 0, 0.05), (0.9, 0, 0.03),
+                                   (1.12, 0, 0.03), (1.0, 80, 0.03),
+                                   (0.95, 40, 0.04)):
+        for e, d in frames(rng):
+            noisy.append((e, distort(d, rng, drift, stretch, jitter)))
+    write('noisy', 'drift, receiver mark stretching and edge jitter', noisy)
+
+    truncated = []
+    for e, d in frames(rng):
+        cut = rng.randint(1, len(d) - 2)
+        truncated.append(('none', distort(d[:cut], rng, jitter=0.02)))
+    for _ in range(8):
+        n = rng.randint(4, 40)
+        truncated.append(('none', [rng.randint(100, 20000) for _ in range(n)]))
+    write('truncated', 'incomplete frames and noise bursts', truncated)
+
+    code, action = NEC_KEYS[0]
+    repeat = [('nec %s %s' % (code_str(code), action), ticks(nec(code)))]
+    for _ in range(6):
+        repeat.append(('repeat', distort(nec_repeat(), rng, jitter=0.03)))
+    write('repeat', 'held NEC key: frame followed by repeat frames', repeat)
+
+
+if __name__ == '__main__':
+    main()
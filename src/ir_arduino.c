@@ -34,18 +34,24 @@
  *  the project and is responsible for the initial application hardware configuration.
  */
 
-#include <util/delay.h>
+#include <util/atomic.h>
 #include "util.h"
 #include "pin_io.h"
 #include "spi.h"
 #include "wdog_timer.h"
+#include "clock.h"
+#include "timer.h"
+#include "ir_decode.h"
+#include "ir_keymap.h"
+#include "evq.h"
+#include "frame.h"
+#include "cdc_tx.h"
+#include "log.h"
+#include "led.h"
+#include "fade.h"
 #include "ir_arduino.h"
 
 
-#define IR_REF 3000
-#define IR_MAX 5000
-#define IR_MIN 1000
-
 /*
  * Hardware configuration:
  */
@@ -65,6 +71,9 @@
 /** Relay 2: Extension/Default Input Jack */
 #define RLY2_ED(op)        PIN_MAKE(D,6,op)
 
+/** Input jacks selected by relays 1 and 2, numbered from 1 */
+#define INPUT_COUNT 3
+
 /** Relay 3: Passive/Active Input */
 #define RLY3_PA(op)        PIN_MAKE(B,7,op)
 
@@ -109,22 +118,63 @@ USB_ClassInfo_CDC_Device_t VirtualSerial_CDC_Interface = {
 	},
 };
 
-FILE usb_stream;
+#if USB_CDC_LOG
+/** LUFA CDC Class driver interface of the debug log, output only. */
+USB_ClassInfo_CDC_Device_t Log_CDC_Interface = {
+	.Config = {
+		.ControlInterfaceNumber = INTERFACE_ID_LOG_CCI,
+		.DataINEndpoint = {
+			.Address = LOG_TX_EPADDR,
+			.Size    = CDC_TXRX_EPSIZE,
+			.Banks   = 1,
+		},
+		.DataOUTEndpoint = {
+			.Address = LOG_RX_EPADDR,
+			.Size    = CDC_TXRX_EPSIZE,
+			.Banks   = 1,
+		},
+		.NotificationEndpoint = {
+			.Address = LOG_NOTIFICATION_EPADDR,
+			.Size    = CDC_NOTIFICATION_EPSIZE,
+			.Banks   = 1,
+		},
+	},
+};
+#endif
+
+#if USB_HID_MEDIA
+/* Last media key report sent, the HID driver only sends changed reports */
+static USB_MediaReport_Data_t PrevMediaReport;
+
+/** LUFA HID Class driver interface of the media keys (Consumer Control). */
+USB_ClassInfo_HID_Device_t Media_HID_Interface = {
+	.Config = {
+		.InterfaceNumber = INTERFACE_ID_Media,
+		.ReportINEndpoint = {
+			.Address = MEDIA_IN_EPADDR,
+			.Size    = MEDIA_EPSIZE,
+			.Banks   = 1,
+		},
+		.PrevReportINBuffer = &PrevMediaReport,
+		.PrevReportINBufferSize = sizeof(PrevMediaReport),
+	},
+};
+#endif
 
 #ifndef DEBUG_LEVEL
 # define DEBUG_LEVEL 1
 #endif
 
-#define __trace_log(level,...) do { \
-	fprintf(&usb_stream, "[" #level "] " __VA_ARGS__); \
+#define __trace_log(level,fmt,...) do { \
+	log_P(PSTR("[" #level "] " fmt), ##__VA_ARGS__); \
 } while (0)
 
 #if DEBUG_LEVEL == 2
-# define info(...) __trace_log(info, __VA_ARGS__)
-# define dbg(...) __trace_log(dbg, __VA_ARGS__)
+# define info(fmt,...) __trace_log(info, fmt, ##__VA_ARGS__)
+# define dbg(fmt,...) __trace_log(dbg, fmt, ##__VA_ARGS__)
 # warning Debug level is DEBUG
 #elif DEBUG_LEVEL == 1
-# define info(...) __trace_log(info, __VA_ARGS__)
+# define info(fmt,...) __trace_log(info, fmt, ##__VA_ARGS__)
 # define dbg(...)
 # warning Debug level is INFO
 #elif DEBUG_LEVEL == 0
@@ -135,336 +185,1231 @@ FILE usb_stream;
 # error Debug level (DEBUG_LEVEL) is invalid (or not set)
 #endif
 
-static struct {
+/* Sleep (idle mode) in the main loop until an interrupt: IR edges, the
+ * USB start of frame every 1ms while configured, Timer 1 or the watchdog */
+#ifndef IDLE_SLEEP
+# define IDLE_SLEEP 1
+#endif
+
+/* Old byte protocol for existing host scripts: digits add to the value
+ * and every letter runs at once with it, there are no command lines */
+#ifndef CMD_LEGACY
+# define CMD_LEGACY 0
+#endif
+
+/* Raw capture keeps the durations of two frames for IR learning (512 bytes
+ * RAM), 'R' streams them to the host as binary packets */
+#ifndef IR_RAW_CAPTURE
+# define IR_RAW_CAPTURE 0
+#endif
+
+#define IR_RAW_STAMPS 128
+
+/* Raw packets carry durations in units of (1 << IR_RAW_SHIFT) ticks */
+#ifndef IR_RAW_SHIFT
+# define IR_RAW_SHIFT 3
+#endif
+
+/* Learn mode: wait for a frame, then for the action to bind */
+#define LEARN_OFF   0
+#define LEARN_FRAME 1
+#define LEARN_BIND  2
+
+/* Opcodes of binary command frames (see doc/protocol.txt) */
+#define CMD_GAIN   0x01 /* u8 gain, unmutes */
+#define CMD_STATE  0x02 /* reply: gain, mute, external power */
+#define CMD_MUTE   0x03 /* u8 0: unmute, 1: mute */
+#define CMD_INPUT  0x04 /* u8 input jack (1..INPUT_COUNT) */
+#define CMD_POWER  0x05 /* u8 external power relay */
+#define CMD_STEP   0x06 /* s8 gain steps */
+
+/* Devices of EV_SPI_DONE events */
+#define SPI_DEV_PGA 0
+
+/* Timer ids of EV_TIMER events */
+#define TIMER_ID_HOLD 0
+#define TIMER_ID_PGA  1
+#define TIMER_ID_FADE 2
+
+/* Minimum time between two PGA writes. A word is 16 bits at F_OSC/128
+ * (128us on the SPI) and applies at once (zero crossing detection is off).
+ * The limit coalesces bursts of changes, and is shorter than a fade tick
+ * so no fade step is skipped. */
+#ifndef PGA_INTERVAL_US
+# define PGA_INTERVAL_US 500
+#endif
+
+/* Fade step interval, independent of the PGA rate limit. At FADE_MS a
+ * fade moves less than a code per tick, at most 2 codes (1dB) in the
+ * steepest part of the S-curve. */
+#define FADE_TICK_MS 1
+
+/* 't': time of a fade over FADE_SPAN codes (mute to 0dB), shorter changes
+ * take proportionally less, so every fade runs at the same rate */
+#ifndef FADE_MS
+# define FADE_MS 250
+#endif
+#define FADE_SPAN 192
+
+#ifndef FADE_CURVE
+# define FADE_CURVE FADE_SCURVE
+#endif
+
+#if IR_RAW_CAPTURE
+/* Raw capture buffer, owned by the ISR until ready is set */
+struct ir_buffer {
+	volatile uint8_t ready;
 	uint8_t received;
-	uint8_t got_events;
-	uint8_t code[4];
-	uint16_t stamps[256];
+	uint16_t stamps[IR_RAW_STAMPS];
+};
+#endif
+
+static struct {
+#if IR_RAW_CAPTURE
+	struct ir_buffer buf[2];
+	uint8_t fill;     /* ISR: buffer of the frame being captured */
+	uint8_t stream;   /* send raw packets to the host */
+	uint8_t seq;      /* raw packet counter */
+#endif
+	uint16_t last;    /* ISR: Timer 1 stamp of the previous edge */
+	uint8_t proto;
+	uint8_t hold;     /* held key ramps the volume */
+	uint8_t repeats;  /* repeat frames since the key was pressed */
+	uint32_t code;
 } g_ir = {
-	.received = 0,
-	.got_events = 0,
-	.code = {0, 0, 0, 0},
+#if IR_RAW_CAPTURE
+	.fill = 0,
+	.stream = 0,
+	.seq = 0,
+#endif
+	.last = 0,
+	.proto = IR_PROTO_NONE,
+	.hold = 0,
+	.repeats = 0,
+	.code = 0,
+};
+
+/* Media key held down (HID usage), released when the hold timer expires */
+static struct {
+	uint16_t usage;
+} g_media = {
+	.usage = 0,
+};
+
+/* HID Consumer usage of each media key (enum ir_media) */
+static const uint16_t media_usage[IR_MEDIA_COUNT] PROGMEM = {
+	[IR_MEDIA_PLAY_PAUSE] = 0x00cd,
+	[IR_MEDIA_NEXT]       = 0x00b5,
+	[IR_MEDIA_PREVIOUS]   = 0x00b6,
+	[IR_MEDIA_STOP]       = 0x00b7,
+	[IR_MEDIA_PLAY]       = 0x00b0,
+	[IR_MEDIA_PAUSE]      = 0x00b1,
+	[IR_MEDIA_MUTE]       = 0x00e2,
+	[IR_MEDIA_VOL_UP]     = 0x00e9,
+	[IR_MEDIA_VOL_DOWN]   = 0x00ea,
+	[IR_MEDIA_HOME]       = 0x0223, /* AC Home */
+	[IR_MEDIA_BACK]       = 0x0224, /* AC Back */
+	[IR_MEDIA_FORWARD]    = 0x0225, /* AC Forward */
+};
+
+static struct {
+	uint8_t state;
+	uint8_t action;   /* 'a': action to bind, 'A' stores it with the value */
+	struct ir_key key;
+} g_learn = {
+	.state = LEARN_OFF,
+	.action = IR_ACT_NONE,
+};
+
+/* PGA writer: gain changes only update want, the writer sends the latest
+ * word at most every PGA_INTERVAL_US and skips words already sent */
+static struct {
+	uint16_t want;    /* word for the current g_vol */
+	uint16_t sent;    /* last word queued for the SPI */
+	uint8_t valid;    /* sent is known (not after reset) */
+} g_pga = {
+	.want = 0,
+	.sent = 0,
+	.valid = 0,
+};
+
+static struct {
+	struct fade fade; /* level: gain sent to the PGA (0: muted) */
+	uint16_t ms;      /* 't': fade time over FADE_SPAN, 0 jumps */
+	uint8_t curve;    /* 'T': FADE_LINEAR or FADE_SCURVE */
+	uint8_t input;    /* input to select once faded out, 0: none */
+} g_fade = {
+	.fade = {
+		.level = 0, /* fade in after reset */
+		.from = 0,
+		.to = 0,
+		.curve = FADE_CURVE,
+		.ticks = 0,
+		.step = 0,
+	},
+	.ms = FADE_MS,
+	.curve = FADE_CURVE,
+	.input = 0,
 };
 
 static struct {
 	uint8_t volume;
+	int8_t balance;   /* > 0: left channel attenuated by this many steps */
 	uint8_t mute;
 	uint8_t ext_power;
 } g_vol = {
 	.volume = 192, /* 0dB */
+	.balance = 0,
 	.mute = 0,
 	.ext_power = 0, /* external power relay [default: off] */
 };
 
+/* ASCII command lines, run at CR/LF */
+#define CMD_LINE_MAX 24
+#define CMD_DISCARD 0xff /* line too long, skipped up to its end */
+
+static struct {
+#if !CMD_LEGACY
+	uint8_t len;
+	char line[CMD_LINE_MAX];
+#endif
+	int16_t value;    /* 'v': default for commands without a number */
+} g_cmd = {
+#if !CMD_LEGACY
+	.len = 0,
+#endif
+	.value = 0,
+};
+
+/* LED patterns of the USB states */
+static const struct led_step led_notready[] PROGMEM = {
+	{ LEDMASK_USB_NOTREADY, 1 },
+	LED_END(LED_HOLD),
+};
+
+static const struct led_step led_enumerating[] PROGMEM = {
+	{ LEDMASK_USB_ENUMERATING, 1 },
+	LED_END(LED_HOLD),
+};
+
+static const struct led_step led_ready[] PROGMEM = {
+	{ LEDMASK_USB_READY, 1 },
+	LED_END(LED_HOLD),
+};
+
+static const struct led_step led_error[] PROGMEM = {
+	{ LEDMASK_USB_ERROR, LED_MS(250) },
+	{ 0, LED_MS(250) },
+	LED_END(LED_REPEAT),
+};
+
+/* Two flashes of all LEDs, then dark */
+static const struct led_step led_suspend[] PROGMEM = {
+	{ LEDS_LED1 | LEDS_LED2 | LEDS_LED3, LED_MS(250) },
+	{ 0, LED_MS(250) },
+	{ LEDS_LED1 | LEDS_LED2 | LEDS_LED3, LED_MS(250) },
+	{ 0, 1 },
+	LED_END(LED_HOLD),
+};
+
+static const struct led_step led_wakeup[] PROGMEM = {
+	{ LEDS_LED1 | LEDS_LED2, 1 },
+	LED_END(LED_HOLD),
+};
+
 volatile uint16_t *bootKeyPtr = (volatile uint16_t *)0x0800;
 
 static void ir_test_main(void);
+static void ir_idle(void);
+static void ir_process(void);
 static void ir_initialize(void);
-static void ir_enable(void);
-static uint8_t ir_evaluate(void);
+static void ir_arm(void);
+#if IR_RAW_CAPTURE
+static void ir_handoff(void);
+static uint8_t ir_raw_put(const uint8_t byte, const uint8_t send);
+static uint16_t ir_raw_encode(const struct ir_buffer *b, const uint8_t send);
+static void ir_raw_send(const struct ir_buffer *b);
+#endif
+static void ir_hold_expired(void);
 static void relay_reset(void);
 static void relay_init(void);
-static void blink(uint8_t max);
+static void input_select(const uint8_t input);
+static int8_t input_set(const uint8_t input);
 static void enter_bootloader(void);
-static void send_to_host(const uint8_t code[4]);
+static void send_to_host(const uint32_t code);
+static uint8_t cmd_exec(const struct frame *f, uint8_t *data, uint8_t *len);
+static void cmd_frame(const uint8_t byte);
+static void cmd_run(const char cmd, const uint8_t has_arg, const int16_t arg);
+#if !CMD_LEGACY
+static void cmd_line(const char *line);
+#endif
+static void cmd_ascii(const uint8_t byte);
+static void learn_frame(void);
+static void learn_bind(const uint8_t arg);
+static void learn_forget(void);
 
 
 ISR(TIMER1_CAPT_vect)
 {
-	static uint16_t tmp = 0;
-	TCNT1 = 0x0000;
-	tmp = ICR1;
-	if ((tmp > IR_MIN) && (tmp < IR_MAX)) {
-		g_ir.stamps[g_ir.received] = tmp;
-		++g_ir.received;
-		if (tmp > IR_REF) {
-			PIN_SET(PIN_DBG_O);
-		} else {
-			PIN_CLEAR(PIN_DBG_O);
+	uint16_t stamp = ICR1;
+	uint16_t tmp;
+	uint8_t level;
+
+	/* Rising edge: receiver output went back to idle, a mark has ended */
+	level = (TCCR1B & (1 << ICES1)) ? IR_MARK : IR_SPACE;
+	TCCR1B ^= (1 << ICES1);
+	TIFR1 = (1 << ICF1); /* required after changing the edge */
+
+	/* Timer 1 runs freely: durations are differences (modulo 2^16) */
+	tmp = stamp - g_ir.last;
+	g_ir.last = stamp;
+	OCR1A = stamp + IR_TIMEOUT;
+
+#if IR_RAW_CAPTURE
+	{
+		struct ir_buffer *b = &g_ir.buf[g_ir.fill];
+
+		if (!b->ready && (b->received < IR_RAW_STAMPS)) {
+			b->stamps[b->received] = tmp;
+			++b->received;
 		}
 	}
+#endif
+
+	switch (ir_decode_edge(level, tmp)) {
+	case IR_DECODE_DONE:
+		evq_post(EV_IR_FRAME, ir_decode_proto(), ir_decode_code());
+		break;
+	case IR_DECODE_REPEAT:
+		evq_post(EV_IR_REPEAT, ir_decode_proto(), ir_decode_code());
+		break;
+	default:
+		return;
+	}
+
+#if !IR_RAW_CAPTURE
+	/* Frame is complete, wait for the next one (raw: until the timeout) */
+	TIMSK1 &= ~((1 << ICIE1) | (1 << OCIE1A));
+	ir_decode_reset();
+	ir_arm();
+#endif
 }
 
 ISR(TIMER1_COMPA_vect)
 {
-	if (g_ir.received > 0) {
-		g_ir.got_events = 1;
-		/* Disable CAPT & OVF */
-		TIMSK1 &= ~((1 << ICIE1) | (1 << OCIE1A));
+	/* Disable CAPT & COMPA */
+	TIMSK1 &= ~((1 << ICIE1) | (1 << OCIE1A));
 
-		/* DBG */
-		PIN_CLEAR(PIN_DBG_O);
-	}
+#if IR_RAW_CAPTURE
+	ir_handoff();
+#endif
+	/* Incomplete or invalid frames are dropped */
+	ir_decode_reset();
+	ir_arm();
 }
 
 ISR(INT0_vect)
 {
-	TCNT1 = 0x0000; /* Reset Timer */
-	/* Enable CAPT & OVF: */
+	/* A mark has started, its length is measured from here */
+	g_ir.last = TCNT1;
+	OCR1A = g_ir.last + IR_TIMEOUT;
+	/* Capture the end of the mark (rising edge) first */
+	TCCR1B |= (1 << ICES1);
+	TIFR1 = (1 << ICF1) | (1 << OCF1A);
+	/* Enable CAPT & COMPA: */
 	TIMSK1 |= (1 << ICIE1) | (1 << OCIE1A);
 	/* Disable INT0 */
 	EIMSK &= ~(1 << INT0);
 
-	/* DBG */
-	PIN_CLEAR(PIN_DBG_O);
+#if IR_RAW_CAPTURE
+	if (!g_ir.buf[g_ir.fill].ready) {
+		g_ir.buf[g_ir.fill].received = 0;
+	}
+#endif
 }
 
-static void ir_enable(void)
+static void ir_arm(void)
 {
-	g_ir.received = 0;
-	g_ir.got_events = 0;
+	/* Edges during the last frame have set the flag as well */
+	EIFR = (1 << INTF0);
 	/* Enable INT0 */
 	EIMSK |= (1 << INT0);
 }
 
-static void ir_initialize(void)
+#if IR_RAW_CAPTURE
+/* Pass the raw stamps to the main loop and capture into the other buffer */
+static void ir_handoff(void)
 {
-	/* Enable Timer 1 unit:
-	 *         filter=1      falling edge    clk/8 */
-	TCCR1B = (1 << ICNC1) | (0 << ICES1) |   0x2;
-	/* Set TOP value for Timer 1 */
-	OCR1A = IR_MAX;
-	/* Enable INT0: 0x2 => falling edge; 0x3 => rising edge */
-	EICRA = 0x3;
-	ir_enable();
+	struct ir_buffer *b = &g_ir.buf[g_ir.fill];
+
+	if (b->ready) {
+		/* Main loop still owns both buffers */
+		evq_post(EV_IR_OVERFLOW, 1, 0);
+		return;
+	}
+	if (b->received == 0) {
+		return;
+	}
+
+	b->ready = 1;
+	if (evq_post(EV_IR_RAW, g_ir.fill, 0) != 0) {
+		b->ready = 0;
+		return;
+	}
+	g_ir.fill ^= 1;
 }
+#endif
 
-static uint8_t ir_evaluate(void)
-{
-	uint8_t index = 0;
-	uint8_t i;
-	uint8_t j;
+#if IR_RAW_CAPTURE
+/* A packet (header and at most 2 bytes per duration) always fits the ring */
+typedef char ir_raw_packet_too_large[((7 + 2 * IR_RAW_STAMPS) <= (CDC_TX_SIZE - 1)) ? 1 : -1];
 
-	if (g_ir.received < 32) {
-		return 0;
+static uint8_t ir_raw_put(const uint8_t byte, const uint8_t send)
+{
+	if (send) {
+		cdc_tx_write(CDC_TX_CTRL, &byte, 1);
 	}
+	return 1;
+}
 
-	for (i = 0; i < 4; ++i) {
-		g_ir.code[i] = 0;
-		for (j = 0; j < 8; ++j) {
-			if (g_ir.stamps[index] > IR_REF) {
-				g_ir.code[i] |= (1 << j);
+/* Encode the durations of a raw capture (see doc/raw.txt), only count the
+ * bytes unless send is set */
+static uint16_t ir_raw_encode(const struct ir_buffer *b, const uint8_t send)
+{
+	uint16_t prev[2] = {0, 0};
+	uint16_t size = 0;
+	uint8_t run = 0;
+
+	for (uint8_t i = 0; i < b->received; ++i) {
+		uint8_t level = (i & 1) ? IR_SPACE : IR_MARK;
+		uint16_t v = b->stamps[i] >> IR_RAW_SHIFT;
+		int16_t delta = v - prev[level];
+
+		prev[level] = v;
+		if (delta == 0) {
+			/* Same as the previous duration of this level */
+			if (++run == 64) {
+				size += ir_raw_put(0x40 | (run - 1), send);
+				run = 0;
 			}
-			++index;
+			continue;
 		}
+		if (run > 0) {
+			size += ir_raw_put(0x40 | (run - 1), send);
+			run = 0;
+		}
+
+		if ((delta >= -32) && (delta < 32)) {
+			size += ir_raw_put(delta & 0x3f, send);
+		} else {
+			size += ir_raw_put(0x80 | ((v >> 8) & 0x7f), send);
+			size += ir_raw_put((uint8_t)v, send);
+		}
+	}
+	if (run > 0) {
+		size += ir_raw_put(0x40 | (run - 1), send);
 	}
 
-	return 1;
+	return size;
 }
 
-static uint8_t ir_iscode(const uint8_t code[4])
+/* Stream one raw capture to the host as binary packet */
+static void ir_raw_send(const struct ir_buffer *b)
 {
-	for (uint8_t i = 0; i < 4; ++i) {
-		if (g_ir.code[i] != code[i]) {
-			return 0;
-		}
+	uint16_t len = ir_raw_encode(b, 0) + 3;
+	uint8_t hdr[7] = {
+		0x00, 'R', (uint8_t)len, (uint8_t)(len >> 8),
+		g_ir.seq, IR_RAW_SHIFT, b->received,
+	};
+
+	if (USB_DeviceState != DEVICE_STATE_Configured) {
+		return;
 	}
-	return 1;
+	/* Whole packet or nothing, the seq gap tells the host */
+	if ((len + 4) > cdc_tx_free(CDC_TX_CTRL)) {
+		info("IR: raw packet dropped (%u bytes)\r\n", len + 4);
+		return;
+	}
+
+	cdc_tx_write(CDC_TX_CTRL, hdr, sizeof(hdr));
+	ir_raw_encode(b, 1);
 }
+#endif
 
+/* Timer callback: no repeat frame for a while, the key was released */
+static void ir_hold_expired(void)
+{
+	evq_post(EV_TIMER, TIMER_ID_HOLD, 0);
+}
+
+static void ir_initialize(void)
+{
+	/* Timer 1 runs freely (see clock_init), enable the noise filter */
+	TCCR1B |= (1 << ICNC1);
+	/* Enable INT0: 0x2 => falling edge (start of a mark); 0x3 => rising edge */
+	EICRA = 0x2;
+	ir_arm();
+}
+
+/* SPI chip select of the PGA (interrupt context) */
+static void pga_cs(const uint8_t select)
+{
+	if (select) {
+		PIN_CLEAR(PGA_CS_NO);
+	} else {
+		PIN_SET(PGA_CS_NO);
+	}
+}
+
+/* SPI completion (interrupt context): the PGA shifts out the previous word */
+static void pga_done(const struct spi_xfer *x)
+{
+	evq_post(EV_SPI_DONE, SPI_DEV_PGA, ((uint32_t)x->data[0] << 8) | x->data[1]);
+}
+
+/* Timer callback: the PGA may be written again */
+static void pga_ready(void)
+{
+	evq_post(EV_TIMER, TIMER_ID_PGA, 0);
+}
+
+/* Send the wanted word unless it is sent already or the last write was
+ * less than PGA_INTERVAL_US ago (the timer event calls again) */
+static void pga_write(void)
+{
+	struct spi_xfer x = {
+		.len = 2,
+		.cs = pga_cs,
+		.done = pga_done,
+	};
+	uint16_t tx = g_pga.want;
+	int8_t ret;
+
+	if ((g_pga.valid && (g_pga.sent == tx)) || timer_pending(TIMER_SLOT_PGA)) {
+		return;
+	}
+
+	x.data[0] = tx >> 8;
+	x.data[1] = tx;
+	ret = spi_submit(&x);
+	if (ret == 0) {
+		g_pga.sent = tx;
+		g_pga.valid = 1;
+	}
+	/* Rest, or retry when the SPI queue was full */
+	timer_start(TIMER_SLOT_PGA, TIMER_US(PGA_INTERVAL_US), 0, pga_ready);
+
+	if (ret < 0) {
+		info("SPI: queue full, %x delayed\r\n", tx);
+	} else {
+		info("SPI: send=%x\r\n", tx);
+	}
+}
+
+/* Timer callback: next fade step */
+static void fade_ready(void)
+{
+	evq_post(EV_TIMER, TIMER_ID_FADE, 0);
+}
+
+/* Want the PGA word for the current fade level and balance */
+static void pga_apply(void)
+{
+	uint8_t left = g_fade.fade.level;
+	uint8_t right = g_fade.fade.level;
+
+	if (g_vol.balance > 0) {
+		left = (left > g_vol.balance) ? (left - g_vol.balance) : 0;
+	} else if (g_vol.balance < 0) {
+		right = (right > -g_vol.balance) ? (right + g_vol.balance) : 0;
+	}
+	/* Right channel is shifted out first */
+	g_pga.want = (right << 8) | left;
+	pga_write();
+}
+
+/* Fade ticks from the current level to target at the rate set with 't' */
+static uint16_t fade_ticks(const uint8_t target)
+{
+	uint8_t level = g_fade.fade.level;
+	uint8_t distance = (target > level) ? (target - level) : (level - target);
+	uint32_t ticks = (uint32_t)distance * g_fade.ms / ((uint32_t)FADE_SPAN * FADE_TICK_MS);
+
+	return (ticks > 0xffff) ? 0xffff : ticks;
+}
+
+/* Gain, mute or balance changed: fade towards the new gain, returns before
+ * anything is sent */
 static void pga_ctrl(void)
 {
-	uint16_t tx = 0;
-	uint16_t rx = 0;
+	uint8_t target = (g_vol.mute || g_fade.input) ? 0 : g_vol.volume;
 
-	if (!g_vol.mute) {
-		tx = (g_vol.volume << 8) | g_vol.volume;
+	if (target != g_fade.fade.to) {
+		fade_retarget(&g_fade.fade, target, fade_ticks(target), g_fade.curve);
 	}
-	_delay_us(1);
-	PIN_CLEAR(PGA_CS_NO);
-	_delay_us(1);
+	pga_apply();
 
-	rx = spi_wtransfer(tx);
-	info("SPI: send=%hx, receive=%hx\r\n", tx, rx);
+	if ((fade_running(&g_fade.fade) || g_fade.input) && !timer_pending(TIMER_SLOT_FADE)) {
+		timer_start(TIMER_SLOT_FADE, TIMER_MS(FADE_TICK_MS), TIMER_MS(FADE_TICK_MS), fade_ready);
+	}
+}
 
-	_delay_us(1);
-	PIN_SET(PGA_CS_NO);
-	_delay_us(1);
+/* Fade tick: next level, switch a pending input once the PGA is muted */
+static void fade_step(void)
+{
+	fade_tick(&g_fade.fade);
+	pga_apply();
+
+	if (fade_running(&g_fade.fade)) {
+		return;
+	}
+	if (g_fade.input) {
+		/* Mute word sent (applied when chip select rises) */
+		if (!g_pga.valid || (g_pga.sent != 0) || spi_busy()) {
+			return;
+		}
+		input_select(g_fade.input);
+		g_fade.input = 0;
+		pga_ctrl(); /* fade in again, the timer keeps running */
+		return;
+	}
+	timer_cancel(TIMER_SLOT_FADE);
 }
 
-static void send_to_host(const uint8_t code[4])
+static void send_to_host(const uint32_t code)
 {
 	if (USB_DeviceState == DEVICE_STATE_Configured) {
-		fprintf( &usb_stream
-		       , "IR: %02hhx%02hhx%02hhx%02hhx#\r\n"
-		       , code[0]
-		       , code[1]
-		       , code[2]
-		       , code[3]
-		       );
+		log_text_P( PSTR("IR: %02hhx%02hhx%02hhx%02hhx#\r\n")
+		          , (uint8_t)code
+		          , (uint8_t)(code >> 8)
+		          , (uint8_t)(code >> 16)
+		          , (uint8_t)(code >> 24)
+		          );
 	}
 }
 
-/*
- - Lauter: a6590af5
- - Leiser: a6590bf4
- - Mute:   a45b1ee1
- - Lautes Setting: a659d728
- - Leises Setting: a659d827
- - Aus: a659d827
- - Ein: a6591ce3
-
- - CH1: a6594cb3
- - CH2: a6590ff0
- - CH3: a65949b6
-*/
+/* Volume steps per frame while a key is held: slow first, then faster */
+static const uint8_t vol_ramp[] PROGMEM = {1, 1, 1, 1, 2, 2, 3, 4, 6, 8, 10, 12, 16};
 
-static void ir_action(void)
-{
-	static const uint8_t vol_up[4]   = {0xa6, 0x59, 0x0a, 0xf5};
-	static const uint8_t vol_down[4] = {0xa6, 0x59, 0x0b, 0xf4};
-	static const uint8_t mute[4]     = {0xa4, 0x5b, 0x1e, 0xe1};
-	static const uint8_t loud[4]     = {0xa6, 0x59, 0xd7, 0x28};
-	static const uint8_t quiet[4]    = {0xa6, 0x59, 0xd8, 0x27};
-	static const uint8_t on[4]       = {0xa6, 0x59, 0xd8, 0x27};
-	static const uint8_t off[4]      = {0xa6, 0x59, 0x1c, 0xe3};
-	static const uint8_t ch1[4]      = {0xa6, 0x59, 0x4c, 0xb3};
-	static const uint8_t ch2[4]      = {0xa6, 0x59, 0x0f, 0xf0};
-	static const uint8_t ch3[4]      = {0xa6, 0x59, 0x49, 0xb6};
-	uint8_t change_pga = 1;
-
-	if (ir_iscode(vol_up)) {
-		if (g_vol.mute) {
-			g_vol.mute = 0;
+static uint8_t vol_step(void)
+{
+	uint8_t i = g_ir.repeats;
+
+	if (i >= sizeof(vol_ramp)) {
+		i = sizeof(vol_ramp) - 1;
+	}
+	return pgm_read_byte(&vol_ramp[i]);
+}
+
+static uint8_t act_vol_up(const uint8_t arg)
+{
+	uint8_t step = vol_step();
+
+	g_ir.hold = 1;
+	if (g_vol.mute) {
+		g_vol.mute = 0;
+	} else {
+		if (g_vol.volume < (0xff - step)) {
+			g_vol.volume += step;
 		} else {
-			if (g_vol.volume < 0xff) {
-				g_vol.volume += 1;
-			} /* else keep max. volume */
+			g_vol.volume = 0xff; /* keep max. volume */
 		}
-	} else if (ir_iscode(vol_down)) {
-		if (g_vol.mute) {
-			g_vol.mute = 0;
-		} else if (g_vol.volume > 0) {
-			g_vol.volume -= 1;
-		} /* else keep minimum volume */
-	} else if (ir_iscode(mute)) {
-		g_vol.mute = 1;
-	} else if (ir_iscode(loud)) {
-		g_vol.mute = 0;
-		g_vol.volume = 192;
-	} else if (ir_iscode(quiet)) {
+	}
+	return 1;
+}
+
+static uint8_t act_vol_down(const uint8_t arg)
+{
+	uint8_t step = vol_step();
+
+	g_ir.hold = 1;
+	if (g_vol.mute) {
 		g_vol.mute = 0;
-		g_vol.volume = 150;
-	} else if (ir_iscode(on)) {
-		info("ON (unsupported)\r\n");
-	} else if (ir_iscode(off)) {
-		info("OFF (unsupported)\r\n");
-	} else if (ir_iscode(ch1)) { /* enable standard input */
-		PIN_SET(RLY3_PA); /* ensure we are in active mode */
+	} else if (g_vol.volume > step) {
+		g_vol.volume -= step;
+	} else {
+		g_vol.volume = 0; /* keep minimum volume */
+	}
+	return 1;
+}
+
+static uint8_t act_mute(const uint8_t arg)
+{
+	g_vol.mute = 1;
+	return 1;
+}
+
+static uint8_t act_preset(const uint8_t arg)
+{
+	g_vol.mute = 0;
+	g_vol.volume = arg;
+	return 1;
+}
+
+static uint8_t act_power_on(const uint8_t arg)
+{
+	info("ON (unsupported)\r\n");
+	return 0;
+}
+
+static uint8_t act_power_off(const uint8_t arg)
+{
+	info("OFF (unsupported)\r\n");
+	return 0;
+}
+
+/* Switch the input relays (the PGA should be muted) */
+static void input_select(const uint8_t input)
+{
+	PIN_SET(RLY3_PA); /* ensure we are in active mode */
+	switch (input) {
+	case 1: /* enable standard input */
 		PIN_SET(RLY2_ED);
 		PIN_CLEAR(RLY1_LU);
-	} else if (ir_iscode(ch2)) { /* enable lower extended input jack */
-		PIN_SET(RLY3_PA); /* ensure we are in active mode */
+		break;
+	case 2: /* enable lower extended input jack */
 		PIN_CLEAR(RLY1_LU);
 		PIN_CLEAR(RLY2_ED);
-	} else if (ir_iscode(ch3)) { /* enable upper extended input jack */
-		PIN_SET(RLY3_PA); /* ensure we are in active mode */
+		break;
+	case 3: /* enable upper extended input jack */
 		PIN_SET(RLY1_LU);
 		PIN_CLEAR(RLY2_ED);
-	} else {
-		change_pga = 0;
+		break;
+	default:
+		break;
 	}
+}
 
-	if (change_pga) {
-		pga_ctrl();
+/* Fade out, switch the input, fade in again (see fade_step) */
+static int8_t input_set(const uint8_t input)
+{
+	if ((input < 1) || (input > INPUT_COUNT)) {
+		return -EINVAL;
 	}
+	g_fade.input = input;
+	pga_ctrl();
+	return 0;
 }
 
-static void ir_test_main(void)
+static uint8_t act_input(const uint8_t arg)
+{
+	input_set(arg);
+	return 0;
+}
+
+static uint8_t act_media(const uint8_t arg)
 {
-	static uint8_t value = 0;
+	if (arg >= IR_MEDIA_COUNT) {
+		return 0;
+	}
+	/* Pressed until no repeat frame follows, the host repeats the key */
+	g_ir.hold = 1;
+	g_media.usage = pgm_read_word(&media_usage[arg]);
+	return 0;
+}
 
-	if (g_ir.got_events) {
-		for (uint8_t i = 0; i < g_ir.received; ++i) {
-			info("stamp [%hhu]: %hu\r\n", i, g_ir.stamps[i]);
-			CDC_Device_USBTask(&VirtualSerial_CDC_Interface);
-			USB_USBTask();
+typedef uint8_t (*ir_handler_t)(const uint8_t arg);
+
+/* Action handlers, indexed by enum ir_action; return 1 to update the PGA */
+static const ir_handler_t ir_handlers[IR_ACT_COUNT] PROGMEM = {
+	[IR_ACT_NONE]       = NULL,
+	[IR_ACT_VOL_UP]     = act_vol_up,
+	[IR_ACT_VOL_DOWN]   = act_vol_down,
+	[IR_ACT_MUTE]       = act_mute,
+	[IR_ACT_PRESET]     = act_preset,
+	[IR_ACT_POWER_ON]   = act_power_on,
+	[IR_ACT_POWER_OFF]  = act_power_off,
+	[IR_ACT_INPUT]      = act_input,
+	[IR_ACT_MEDIA]      = act_media,
+};
+
+static void ir_action(const uint8_t repeat)
+{
+	struct ir_key key;
+	ir_handler_t handler;
+
+	if (repeat) {
+		if (!g_ir.hold) {
+			return; /* only volume keys repeat */
 		}
-		info("Processed %hhd stamps\r\n", g_ir.received);
-		if (ir_evaluate()) {
-			info("%02hhx%02hhx%02hhx%02hhx\r\n", g_ir.code[0], g_ir.code[1], g_ir.code[2], g_ir.code[3]);
-			ir_action();
-			send_to_host(g_ir.code);
+		if (g_ir.repeats < 0xff) {
+			++g_ir.repeats;
 		}
-		ir_enable();
+	} else {
+		g_ir.hold = 0;
+		g_ir.repeats = 0;
 	}
-	CDC_Device_USBTask(&VirtualSerial_CDC_Interface);
-	USB_USBTask();
 
-	if (CDC_Device_BytesReceived(&VirtualSerial_CDC_Interface)) {
-		int16_t key = CDC_Device_ReceiveByte(&VirtualSerial_CDC_Interface);
+	if (!ir_keymap_lookup(g_ir.code, g_ir.proto, &key) ||
+	    (key.action >= IR_ACT_COUNT)) {
+		return;
+	}
 
-		switch (key) {
-		case 'b':
-			relay_reset();
-			enter_bootloader();
-			break;
-		case 'v':
-			value = 0;
-			break;
+	handler = (ir_handler_t)pgm_read_word(&ir_handlers[key.action]);
+	if ((handler != NULL) && handler(key.arg)) {
+		pga_ctrl();
+	}
 
-		case '0':
-		case '1':
-		case '2':
-		case '3':
-		case '4':
-		case '5':
-		case '6':
-		case '7':
-		case '8':
-		case '9':
-			value *= 10;
-			value += (key - '0');
-			dbg("Value = %u\r\n", (unsigned int)value);
-			break;
-		case 'V':
-			if (g_vol.volume != value) {
-				g_vol.volume = value;
-				info("Set gain: %u\r\n", (unsigned int)value);
-				pga_ctrl();
+	if (g_ir.hold) {
+		/* Repeat frames follow every 108ms while the key is held */
+		timer_start(TIMER_SLOT_HOLD, TIMER_MS(250), 0, ir_hold_expired);
+	}
+}
+
+/* Learn mode: the received key is bound instead of dispatched */
+static void learn_frame(void)
+{
+	g_learn.key.code = g_ir.code;
+	g_learn.key.proto = g_ir.proto;
+	g_learn.state = LEARN_BIND;
+	log_text_P( PSTR("LEARN:%hhu:%02hhx%02hhx%02hhx%02hhx#\r\n")
+	          , g_ir.proto
+	          , (uint8_t)g_ir.code
+	          , (uint8_t)(g_ir.code >> 8)
+	          , (uint8_t)(g_ir.code >> 16)
+	          , (uint8_t)(g_ir.code >> 24)
+	          );
+}
+
+static void learn_bind(const uint8_t arg)
+{
+	int8_t ret = -ENOENT;
+
+	if ((g_learn.state == LEARN_BIND) && (g_learn.action < IR_ACT_COUNT)) {
+		g_learn.key.action = g_learn.action;
+		g_learn.key.arg = arg;
+		ret = ir_keymap_learn(&g_learn.key);
+	}
+	g_learn.state = LEARN_OFF;
+	log_text_P(PSTR("BIND:%hhd:%hhu#\r\n"), ret, ir_keymap_learned());
+}
+
+static void learn_forget(void)
+{
+	int8_t ret = -ENOENT;
+
+	if (g_learn.state == LEARN_BIND) {
+		ret = ir_keymap_forget(g_learn.key.code, g_learn.key.proto);
+	}
+	g_learn.state = LEARN_OFF;
+	log_text_P(PSTR("BIND:%hhd:%hhu#\r\n"), ret, ir_keymap_learned());
+}
+
+static void ir_process(void)
+{
+	struct event ev;
+
+	while (evq_get(&ev)) {
+		switch (ev.type) {
+		case EV_IR_FRAME:
+			g_ir.code = ev.data;
+			g_ir.proto = ev.arg;
+			info( "proto %hhu: %02hhx%02hhx%02hhx%02hhx\r\n"
+			    , g_ir.proto
+			    , (uint8_t)g_ir.code
+			    , (uint8_t)(g_ir.code >> 8)
+			    , (uint8_t)(g_ir.code >> 16)
+			    , (uint8_t)(g_ir.code >> 24)
+			    );
+			dbg("frame @%lu, latency %lu ticks\r\n", ev.time, clock_now() - ev.time);
+			led_flash(LEDMASK_IR_ACTIVITY, LED_MS(50));
+			if (g_learn.state != LEARN_OFF) {
+				learn_frame();
+				break;
 			}
+			/* DBG: high while the frame is handled */
+			PIN_SET(PIN_DBG_O);
+			ir_action(0);
+			PIN_CLEAR(PIN_DBG_O);
+			send_to_host(g_ir.code);
 			break;
-		case 'i':
-			fprintf( &usb_stream
-			       , "Current gain: %u\r\n"
-			       , (unsigned int)g_vol.volume
-			       );
-			break;
-		case 'I':
-			fprintf( &usb_stream
-			       , "VOL:%u#\r\n"
-			       , (unsigned int)g_vol.volume
-			       );
+		case EV_IR_REPEAT:
+			dbg("repeat %hhu\r\n", g_ir.repeats);
+			led_flash(LEDMASK_IR_ACTIVITY, LED_MS(50));
+			ir_action(1);
 			break;
-		case 'Q':
-			if (g_vol.volume > 6) {
-				g_vol.volume -= 6;
-				pga_ctrl();
+#if IR_RAW_CAPTURE
+		case EV_IR_RAW:
+			if (g_ir.stream) {
+				ir_raw_send(&g_ir.buf[ev.arg]);
 			}
+			/* Give the buffer back to the ISR */
+			g_ir.buf[ev.arg].ready = 0;
+			++g_ir.seq;
 			break;
-		case 'L':
-			if (g_vol.volume < 250) {
-				g_vol.volume += 6;
-				pga_ctrl();
-			}
+#endif
+		case EV_IR_OVERFLOW:
+			info("IR: lost %hhu events\r\n", ev.arg);
 			break;
-		case 'p':
-			info("Disable external Relay");
-			g_vol.ext_power = 0;
-			PIN_CLEAR(RLY5_PWR);
+		case EV_SPI_DONE:
+			info("SPI: receive=%x\r\n", (uint16_t)ev.data);
 			break;
-		case 'P':
-			info("Enable external Relay");
-			g_vol.ext_power = 1;
-			PIN_SET(RLY5_PWR);
+		case EV_TIMER:
+			if (ev.arg == TIMER_ID_HOLD) {
+				g_ir.hold = 0;
+				g_media.usage = 0;
+			} else if (ev.arg == TIMER_ID_PGA) {
+				pga_write();
+			} else if (ev.arg == TIMER_ID_FADE) {
+				fade_step();
+			}
 			break;
 		default:
-			info("Unsupported key: %hx\r\n", key);
 			break;
 		}
 	}
 }
 
+/* Execute a binary command, returns 0 or an error code for the nack */
+static uint8_t cmd_exec(const struct frame *f, uint8_t *data, uint8_t *len)
+{
+	uint8_t arg = 0;
+
+	if ((f->op == CMD_STATE) ? (f->len != 0) : (f->len != 1)) {
+		return EINVAL;
+	}
+	if (f->len > 0) {
+		arg = f->data[0];
+	}
+
+	switch (f->op) {
+	case CMD_GAIN:
+		g_vol.volume = arg;
+		g_vol.mute = 0;
+		break;
+	case CMD_STATE:
+		data[0] = g_vol.volume;
+		data[1] = g_vol.mute;
+		data[2] = g_vol.ext_power;
+		*len = 3;
+		return 0;
+	case CMD_MUTE:
+		g_vol.mute = arg ? 1 : 0;
+		break;
+	case CMD_INPUT:
+		return (input_set(arg) == 0) ? 0 : EINVAL;
+	case CMD_POWER:
+		g_vol.ext_power = arg ? 1 : 0;
+		PIN_SET_LEVEL(RLY5_PWR, g_vol.ext_power);
+		return 0;
+	case CMD_STEP: {
+		int16_t volume = g_vol.volume + (int8_t)arg;
+
+		if (volume < 0) {
+			volume = 0;
+		} else if (volume > 0xff) {
+			volume = 0xff;
+		}
+		g_vol.volume = volume;
+		break;
+	}
+	default:
+		return EINVAL;
+	}
+
+	pga_ctrl();
+	return 0;
+}
+
+/* Binary frames: every frame is acked (status 0) or nacked */
+static void cmd_frame(const uint8_t byte)
+{
+	struct frame f;
+	uint8_t reply[FRAME_MAX - 1];
+	uint8_t buf[FRAME_MAX + FRAME_OVERHEAD];
+	uint8_t len = 0;
+	int8_t ret = frame_feed(byte, &f);
+
+	if (ret == 0) {
+		return;
+	}
+
+	if (ret < 0) {
+		reply[0] = -ret;
+	} else {
+		reply[0] = cmd_exec(&f, &reply[1], &len);
+	}
+
+	if (USB_DeviceState == DEVICE_STATE_Configured) {
+		cdc_tx_write(CDC_TX_CTRL, buf, frame_encode(buf, f.seq, f.op, reply, len + 1));
+	}
+}
+
+static uint8_t cmd_u8(const int16_t arg)
+{
+	if (arg < 0) {
+		return 0;
+	}
+	return (arg > 0xff) ? 0xff : arg;
+}
+
+static void cmd_gain(const int16_t volume)
+{
+	uint8_t tmp = cmd_u8(volume);
+
+	if (g_vol.volume != tmp) {
+		g_vol.volume = tmp;
+		info("Set gain: %u\r\n", (unsigned int)tmp);
+		pga_ctrl();
+	}
+}
+
+/* ASCII command: a letter, optionally followed by a signed number. Commands
+ * that take a value use the last 'v' value if the number is missing. */
+static void cmd_run(const char cmd, const uint8_t has_arg, const int16_t arg)
+{
+	uint8_t step;
+
+	switch (cmd) {
+	case 'b':
+		relay_reset();
+		enter_bootloader();
+		break;
+	case 'v':
+		g_cmd.value = has_arg ? arg : 0;
+		dbg("Value = %d\r\n", g_cmd.value);
+		break;
+	case 'V':
+		cmd_gain(arg);
+		break;
+	case 'i':
+#if USB_CDC_LOG
+		log_text_P( PSTR("Current gain: %u, balance: %d, tx dropped: %u, log: %u\r\n")
+		          , (unsigned int)g_vol.volume
+		          , (int)g_vol.balance
+		          , cdc_tx_dropped(CDC_TX_CTRL)
+		          , cdc_tx_dropped(CDC_TX_LOG)
+		          );
+#else
+		/* The log shares the control channel and its counter */
+		log_text_P( PSTR("Current gain: %u, balance: %d, tx dropped: %u\r\n")
+		          , (unsigned int)g_vol.volume
+		          , (int)g_vol.balance
+		          , cdc_tx_dropped(CDC_TX_CTRL)
+		          );
+#endif
+		break;
+	case 'I':
+		log_text_P( PSTR("VOL:%u#\r\n")
+		          , (unsigned int)g_vol.volume
+		          );
+		break;
+	case 'Q':
+		/* Steps that would go below 0 or above 255 are ignored */
+		step = has_arg ? cmd_u8(arg) : 6;
+		if (g_vol.volume > step) {
+			cmd_gain(g_vol.volume - step);
+		}
+		break;
+	case 'L':
+		step = has_arg ? cmd_u8(arg) : 6;
+		if (g_vol.volume < (256 - step)) {
+			cmd_gain(g_vol.volume + step);
+		}
+		break;
+	case 'B':
+		/* > 0 attenuates the left, < 0 the right channel */
+		if (arg < -127) {
+			g_vol.balance = -127;
+		} else if (arg > 127) {
+			g_vol.balance = 127;
+		} else {
+			g_vol.balance = arg;
+		}
+		pga_ctrl();
+		break;
+	case 'E':
+		if (input_set(cmd_u8(arg)) != 0) {
+			info("Invalid input: %d\r\n", arg);
+		}
+		break;
+	case 't':
+		g_fade.ms = (arg < 0) ? 0 : arg;
+		info("Fade: %u ms\r\n", g_fade.ms);
+		break;
+	case 'T':
+		g_fade.curve = cmd_u8(arg);
+		break;
+	case 'S':
+		/* 0: speakers, 1: headphones */
+		PIN_SET_LEVEL(RLY4_SH, arg != 0);
+		break;
+	case 'l':
+		/* Learn: next frame, then 'a' with the action and 'A' with its argument */
+		g_learn.state = (g_learn.state == LEARN_OFF) ? LEARN_FRAME : LEARN_OFF;
+		g_learn.action = IR_ACT_NONE;
+		info("Learn mode: %hhu\r\n", g_learn.state);
+		break;
+	case 'a':
+		g_learn.action = cmd_u8(arg);
+		break;
+	case 'A':
+		learn_bind(cmd_u8(arg));
+		break;
+	case 'F':
+		learn_forget();
+		break;
+	case 'C':
+		ir_keymap_clear();
+		info("Learned keys cleared\r\n");
+		break;
+#if IR_RAW_CAPTURE
+	case 'r':
+		g_ir.stream = 0;
+		break;
+	case 'R':
+		g_ir.stream = 1;
+		break;
+#endif
+	case 'p':
+		info("Disable external Relay");
+		g_vol.ext_power = 0;
+		PIN_CLEAR(RLY5_PWR);
+		break;
+	case 'P':
+		info("Enable external Relay");
+		g_vol.ext_power = 1;
+		PIN_SET(RLY5_PWR);
+		break;
+	default:
+		info("Unsupported command: %c\r\n", cmd);
+		break;
+	}
+}
+
+static uint8_t cmd_letter(const char c)
+{
+	return (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'))) ? 1 : 0;
+}
+
+static uint8_t cmd_digit(const char c)
+{
+	return ((c >= '0') && (c <= '9')) ? 1 : 0;
+}
+
+#if CMD_LEGACY
+/* Old byte protocol: "v123V" sets gain 123, "i" prints it */
+static void cmd_ascii(const uint8_t byte)
+{
+	if (cmd_digit(byte)) {
+		if (g_cmd.value < 1000) {
+			g_cmd.value = g_cmd.value * 10 + (byte - '0');
+		}
+		dbg("Value = %d\r\n", g_cmd.value);
+	} else if (cmd_letter(byte)) {
+		cmd_run(byte, 0, g_cmd.value);
+	}
+}
+#else
+static void cmd_line(const char *line)
+{
+	const char *p = &line[1];
+	int16_t arg = g_cmd.value;
+	uint8_t has_arg = 0;
+	uint8_t neg = 0;
+
+	while (*p == ' ') {
+		++p;
+	}
+	if ((*p == '-') || (*p == '+')) {
+		neg = (*p == '-');
+		++p;
+		if (!cmd_digit(*p)) {
+			p = line; /* sign without a number */
+		}
+	}
+	if (cmd_digit(*p)) {
+		has_arg = 1;
+		arg = 0;
+		while (cmd_digit(*p)) {
+			if (arg < 1000) {
+				arg = arg * 10 + (*p - '0');
+			}
+			++p;
+		}
+		if (neg) {
+			arg = -arg;
+		}
+	}
+	while (*p == ' ') {
+		++p;
+	}
+
+	if (cmd_letter(line[0]) && (*p == '\0')) {
+		cmd_run(line[0], has_arg, arg);
+	} else {
+		info("Invalid command: %s\r\n", line);
+	}
+}
+
+/* Collect ASCII bytes into a line, run it at CR/LF. Nothing runs before
+ * the line end, so a command can be typed slowly at a terminal. */
+static void cmd_ascii(const uint8_t byte)
+{
+	if ((byte == '\r') || (byte == '\n')) {
+		if (g_cmd.len == CMD_DISCARD) {
+			info("Command too long\r\n");
+		} else if (g_cmd.len > 0) {
+			g_cmd.line[g_cmd.len] = '\0';
+			cmd_line(g_cmd.line);
+		}
+		g_cmd.len = 0;
+	} else if (g_cmd.len >= (CMD_LINE_MAX - 1)) {
+		g_cmd.len = CMD_DISCARD;
+	} else {
+		g_cmd.line[g_cmd.len++] = byte;
+	}
+}
+#endif
+
+static void ir_test_main(void)
+{
+	int16_t byte;
+
+	ir_process();
+	ir_keymap_commit();
+	cdc_tx_flush();
+	CDC_Device_USBTask(&VirtualSerial_CDC_Interface);
+#if USB_CDC_LOG
+	CDC_Device_USBTask(&Log_CDC_Interface);
+#endif
+#if USB_HID_MEDIA
+	HID_Device_USBTask(&Media_HID_Interface);
+#endif
+	USB_USBTask();
+
+	/* Everything the host has sent so far is handled in this pass */
+	while ((byte = CDC_Device_ReceiveByte(&VirtualSerial_CDC_Interface)) >= 0) {
+		if (frame_busy() || frame_start(byte)) {
+			cmd_frame(byte);
+		} else {
+			cmd_ascii(byte);
+		}
+	}
+
+#if USB_CDC_LOG
+	/* Commands are only accepted on the control interface */
+	while (CDC_Device_ReceiveByte(&Log_CDC_Interface) >= 0) {
+	}
+#endif
+}
+
+/* Sleep until the next interrupt unless an event is already waiting. Every
+ * ISR that has work for the main loop posts an event, the USB endpoints
+ * (which have no interrupts here) are polled after each start of frame.
+ * Pending EEPROM writes keep the loop running. */
+static void ir_idle(void)
+{
+#if IDLE_SLEEP
+	cli();
+	if (evq_empty() && !ir_keymap_busy()) {
+		IDLE_MCU_LOCKED();
+	} else {
+		sei();
+	}
+#endif
+}
+
 /** Main program entry point. This routine contains the overall program flow, including initial
  *  setup of all components and the main program loop.
  */
@@ -472,16 +1417,17 @@ int main(void)
 {
 	SetupHardware();
 	VirtualSerial_CDC_Interface.State.LineEncoding.BaudRateBPS = 9600; /* Reset variable to some default value */
-	CDC_Device_CreateStream(&VirtualSerial_CDC_Interface, &usb_stream);
 
-	LEDs_SetAllLEDs(LEDMASK_USB_NOTREADY);
+	led_pattern(led_notready);
 	GlobalInterruptEnable();
 
+	ir_keymap_init();
 	ir_initialize();
 	pga_ctrl();
 
 	while (1) {
 		ir_test_main();
+		ir_idle();
 	}
 }
 
@@ -533,7 +1479,8 @@ void SetupHardware(void)
 	PIN_CLEAR(PIN_DBG_O);
 	PIN_DIR_OUT(PIN_DBG_O);
 
-	/* PGA */
+	/* PGA, zero crossing detection off: every word applies at once, the
+	 * fades keep the steps small instead */
 	PIN_CLEAR(PGA_ZCEN_O);
 	PIN_SET(PGA_CS_NO);
 	PIN_SET(PGA_MUTE_NO);
@@ -544,6 +1491,9 @@ void SetupHardware(void)
 	/* SPI */
 	spi_init_master();
 
+	/* Timer 1 time base (IR capture) */
+	clock_init();
+
 	/* Hardware Initialization */
 	LEDs_Init();
 	USB_Init();
@@ -554,13 +1504,13 @@ void SetupHardware(void)
 /** Event handler for the library USB Connection event. */
 void EVENT_USB_Device_Connect(void)
 {
-	LEDs_SetAllLEDs(LEDMASK_USB_ENUMERATING);
+	led_pattern(led_enumerating);
 }
 
 /** Event handler for the library USB Disconnection event. */
 void EVENT_USB_Device_Disconnect(void)
 {
-	LEDs_SetAllLEDs(LEDMASK_USB_NOTREADY);
+	led_pattern(led_notready);
 }
 
 /** Event handler for the library USB Configuration Changed event. */
@@ -569,32 +1519,87 @@ void EVENT_USB_Device_ConfigurationChanged(void)
 	bool ConfigSuccess = true;
 
 	ConfigSuccess &= CDC_Device_ConfigureEndpoints(&VirtualSerial_CDC_Interface);
+#if USB_CDC_LOG
+	ConfigSuccess &= CDC_Device_ConfigureEndpoints(&Log_CDC_Interface);
+#endif
+#if USB_HID_MEDIA
+	ConfigSuccess &= HID_Device_ConfigureEndpoints(&Media_HID_Interface);
+#endif
+#if IDLE_SLEEP || USB_HID_MEDIA
+	/* Wakes the main loop to service the CDC and HID endpoints, and
+	 * clocks the HID idle rate */
+	USB_Device_EnableSOFEvents();
+#endif
 
-	LEDs_SetAllLEDs(ConfigSuccess ? LEDMASK_USB_READY : LEDMASK_USB_ERROR);
+	led_pattern(ConfigSuccess ? led_ready : led_error);
 }
 
 /** Event handler for the library USB Control Request reception event. */
 void EVENT_USB_Device_ControlRequest(void)
 {
 	CDC_Device_ProcessControlRequest(&VirtualSerial_CDC_Interface);
+#if USB_CDC_LOG
+	CDC_Device_ProcessControlRequest(&Log_CDC_Interface);
+#endif
+#if USB_HID_MEDIA
+	HID_Device_ProcessControlRequest(&Media_HID_Interface);
+#endif
+}
+
+#if IDLE_SLEEP || USB_HID_MEDIA
+/** Event handler for the USB start of frame (every 1ms): wakes the main loop and
+ *  ticks the HID idle rate (SET_IDLE) in every build. */
+void EVENT_USB_Device_StartOfFrame(void)
+{
+#if USB_HID_MEDIA
+	HID_Device_MillisecondElapsed(&Media_HID_Interface);
+#endif
 }
+#endif
 
 void EVENT_USB_Device_Suspend(void)
 {
-	blink(2);
+	led_pattern(led_suspend);
 }
 
 void EVENT_USB_Device_WakeUp(void)
 {
-	LEDs_SetAllLEDs(LEDS_LED1 | LEDS_LED2);
+	led_pattern(led_wakeup);
 }
 
 //void EVENT_CDC_Device_ControLineStateChanged(USB_ClassInfo_CDC_Device_t* const CDCInterfaceInfo)
 //{
-//	fprintf(&usb_stream, "H2D: %lx\r\n", (long)CDCInterfaceInfo->State.ControlLineStates.HostToDevice);
-//	fprintf(&usb_stream, "D2H: %lx\r\n", (long)CDCInterfaceInfo->State.ControlLineStates.DeviceToHost);
+//	log_text_P(PSTR("H2D: %lx\r\n"), (long)CDCInterfaceInfo->State.ControlLineStates.HostToDevice);
+//	log_text_P(PSTR("D2H: %lx\r\n"), (long)CDCInterfaceInfo->State.ControlLineStates.DeviceToHost);
 //}
 
+#if USB_HID_MEDIA
+/** HID class driver callback to create the media key report: the held key or 0.
+ *
+ *  \return false, the driver sends the report only if it differs from the last one
+ */
+bool CALLBACK_HID_Device_CreateHIDReport(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo,
+                                         uint8_t* const ReportID,
+                                         const uint8_t ReportType,
+                                         void* ReportData,
+                                         uint16_t* const ReportSize)
+{
+	USB_MediaReport_Data_t *report = (USB_MediaReport_Data_t *)ReportData;
+
+	report->Usage = g_media.usage;
+	*ReportSize = sizeof(USB_MediaReport_Data_t);
+	return false;
+}
+
+/** HID class driver callback for reports from the host, the media interface has none. */
+void CALLBACK_HID_Device_ProcessHIDReport(USB_ClassInfo_HID_Device_t* const HIDInterfaceInfo,
+                                          const uint8_t ReportID,
+                                          const uint8_t ReportType,
+                                          const void* ReportData,
+                                          const uint16_t ReportSize)
+{}
+#endif
+
 /** Event handler for the CDC Class driver Line Encoding Changed event.
  *
  *  \param[in] CDCInterfaceInfo  Pointer to the CDC class interface configuration structure being referenced
@@ -611,15 +1616,3 @@ static void enter_bootloader(void)
 	wdt_enable(WDTO_250MS);
 	while (1) { }
 }
-
-static void blink(uint8_t max)
-{
-	uint8_t i;
-
-	for (i = 0; i < max; ++i) {
-		LEDs_SetAllLEDs(LEDS_LED1 | LEDS_LED2 | LEDS_LED3);
-		_delay_ms(250);
-		LEDs_SetAllLEDs(0);
-		_delay_ms(250);
-	}
-}
@@ -63,7 +63,8 @@
 		/** LED mask for the library LED driver, to indicate that an error has occurred in the USB interface. */
 		#define LEDMASK_USB_ERROR        (LEDS_LED1 | LEDS_LED3)
 
-		extern FILE usb_stream;
+		/** LED mask for the library LED driver, toggled briefly for every received IR frame. */
+		#define LEDMASK_IR_ACTIVITY       LEDS_LED1
 
 	/* Function Prototypes: */
 		void SetupHardware(void);
@@ -0,0 +1,558 @@
+#include <avr/pgmspace.h>
+#include <string.h>
+
+#include "ir_decode.h"
+
+/* Table driven IR decoder
+ *
+ * The capture ISR feeds the duration of every mark and space into
+ * ir_decode_edge(). The length of the first mark selects the few
+ * templates whose leader can match it (ir_bins[]), only those are
+ * compared against the precomputed windows of the first mark/space pair.
+ * The matching template is copied to RAM and every following duration is
+ * handled by exactly one O(1) step, no matter how many protocols are
+ * enabled.
+ *
+ * All timings are multiples of the protocol's unit. Durations are
+ * classified into 1, 2 or 3 units within a window of IR_TOL_SHIFT. With
+ * IR_CALIBRATE the unit is measured from the first mark and space of
+ * every frame, so remotes with a drifting resonator or weak batteries are
+ * decoded against their own timing. Mark + space is used because the
+ * receiver stretches marks and shortens spaces by the same amount.
+ */
+
+#define IR_CODING_DISTANCE  0 /* space length encodes the bit (NEC) */
+#define IR_CODING_WIDTH     1 /* mark length encodes the bit (SIRC) */
+#define IR_CODING_MANCHESTER 2 /* bi-phase, one unit per half bit (RC5) */
+
+#define IR_F_LSB_FIRST  0x01
+#define IR_F_MARK_FIRST 0x02 /* manchester: mark-space encodes a one */
+#define IR_F_NO_HEADER  0x04 /* the first mark is data (RC5) */
+
+#define IR_NO_TRAILER 0xff
+#define IR_NO_MATCH   0xffff
+
+/* Reciprocal (16 bit fraction) of the units spanned by the first mark/space */
+#define IR_RECIP(units) ((uint16_t)(65536UL / (units)))
+
+/* Leader durations match within +-(ref >> IR_HDR_TOL) */
+#define IR_HDR_TOL 2
+#define IR_WIN(ticks) { .ref = (ticks), .tol = (ticks) >> IR_HDR_TOL }
+#define IR_WIN_NONE { .ref = 0, .tol = 0 }
+
+#define IR_NEC_UNIT     IR_US(560)
+#define IR_SAMSUNG_UNIT IR_US(560)
+#define IR_SIRC_UNIT    IR_US(600)
+#define IR_RC6_UNIT     IR_US(444)
+#define IR_RC5_UNIT     IR_US(889)
+
+#define IR_NEC_MARK     (16 * IR_NEC_UNIT)
+#define IR_SAMSUNG_MARK (8 * IR_SAMSUNG_UNIT)
+#define IR_SIRC_MARK    (4 * IR_SIRC_UNIT)
+#define IR_RC6_MARK     (6 * IR_RC6_UNIT)
+
+/* Decoder state copied to RAM for the selected protocol */
+struct ir_protocol {
+	uint8_t id;
+	uint8_t coding;
+	uint8_t flags;
+	uint8_t bits;
+	uint16_t unit;      /* ticks */
+	uint8_t trailer;    /* manchester bit with double width halves */
+	uint16_t cal;       /* IR_RECIP() of the first mark + space */
+	uint32_t toggle;    /* bits masked out of the reported code */
+};
+
+struct ir_window {
+	uint16_t ref;       /* ticks */
+	uint16_t tol;       /* ticks */
+};
+
+/* Leader windows are only read from flash while the header is matched */
+struct ir_template {
+	struct ir_protocol p;
+	struct ir_window mark;  /* header mark, IR_F_NO_HEADER: one unit */
+	struct ir_window space; /* header space, IR_F_NO_HEADER: two units */
+	struct ir_window rpt;   /* repeat space, ref 0: no repeat frames */
+};
+
+static const struct ir_template ir_protocols[] PROGMEM = {
+#if IR_PROTO_NEC_ENABLE
+	{
+		.p = {
+			.id = IR_PROTO_NEC,
+			.coding = IR_CODING_DISTANCE,
+			.flags = IR_F_LSB_FIRST,
+			.bits = 32,
+			.unit = IR_NEC_UNIT,
+			.trailer = IR_NO_TRAILER,
+			.cal = IR_RECIP(16 + 8),
+			.toggle = 0,
+		},
+		.mark = IR_WIN(IR_NEC_MARK),
+		.space = IR_WIN(8 * IR_NEC_UNIT),
+		.rpt = IR_WIN(4 * IR_NEC_UNIT), /* followed by a single stop mark */
+	},
+#endif
+#if IR_PROTO_SAMSUNG_ENABLE
+	{
+		.p = {
+			.id = IR_PROTO_SAMSUNG,
+			.coding = IR_CODING_DISTANCE,
+			.flags = IR_F_LSB_FIRST,
+			.bits = 32,
+			.unit = IR_SAMSUNG_UNIT,
+			.trailer = IR_NO_TRAILER,
+			.cal = IR_RECIP(8 + 8),
+			.toggle = 0,
+		},
+		.mark = IR_WIN(IR_SAMSUNG_MARK),
+		.space = IR_WIN(8 * IR_SAMSUNG_UNIT),
+		.rpt = IR_WIN_NONE,
+	},
+#endif
+#if IR_PROTO_SIRC_ENABLE
+	{
+		.p = {
+			.id = IR_PROTO_SIRC,
+			.coding = IR_CODING_WIDTH,
+			.flags = IR_F_LSB_FIRST,
+			.bits = 12,
+			.unit = IR_SIRC_UNIT,
+			.trailer = IR_NO_TRAILER,
+			.cal = IR_RECIP(4 + 1),
+			.toggle = 0,
+		},
+		.mark = IR_WIN(IR_SIRC_MARK),
+		.space = IR_WIN(1 * IR_SIRC_UNIT),
+		.rpt = IR_WIN_NONE,
+	},
+#endif
+#if IR_PROTO_RC6_ENABLE
+	{
+		/* mode 0: start bit, 3 mode bits, trailer (toggle), 16 data bits */
+		.p = {
+			.id = IR_PROTO_RC6,
+			.coding = IR_CODING_MANCHESTER,
+			.flags = IR_F_MARK_FIRST,
+			.bits = 21,
+			.unit = IR_RC6_UNIT,
+			.trailer = 4,
+			.cal = IR_RECIP(6 + 2),
+			.toggle = (1UL << 16),
+		},
+		.mark = IR_WIN(IR_RC6_MARK),
+		.space = IR_WIN(2 * IR_RC6_UNIT),
+		.rpt = IR_WIN_NONE,
+	},
+#endif
+#if IR_PROTO_RC5_ENABLE
+	{
+		/* 2 start bits, toggle, 5 address and 6 command bits */
+		.p = {
+			.id = IR_PROTO_RC5,
+			.coding = IR_CODING_MANCHESTER,
+			.flags = IR_F_NO_HEADER,
+			.bits = 14,
+			.unit = IR_RC5_UNIT,
+			.trailer = IR_NO_TRAILER,
+			.cal = IR_RECIP(1 + 1),
+			.toggle = (1UL << 11),
+		},
+		.mark = IR_WIN(IR_RC5_UNIT),
+		.space = IR_WIN(2 * IR_RC5_UNIT),
+		.rpt = IR_WIN_NONE,
+	},
+#endif
+};
+
+/* Index of each enabled template in ir_protocols[] */
+#define IR_T_NEC     0
+#define IR_T_SAMSUNG (IR_T_NEC + (IR_PROTO_NEC_ENABLE != 0))
+#define IR_T_SIRC    (IR_T_SAMSUNG + (IR_PROTO_SAMSUNG_ENABLE != 0))
+#define IR_T_RC6     (IR_T_SIRC + (IR_PROTO_SIRC_ENABLE != 0))
+#define IR_T_RC5     (IR_T_RC6 + (IR_PROTO_RC6_ENABLE != 0))
+
+/* Leader dispatch: the first mark, quantised to 1 << IR_BIN_SHIFT ticks
+ * (256us), selects a bin. Each bin has a mask of the templates whose
+ * first mark window overlaps it, so only those few are matched. */
+#define IR_BIN_SHIFT 9
+#define IR_BINS 48
+
+#define IR_LO(ref) ((uint32_t)(ref) - ((ref) >> IR_HDR_TOL))
+#define IR_HI(ref) ((uint32_t)(ref) + ((ref) >> IR_HDR_TOL))
+#define IR_BIN_HIT(k, lo, hi) \
+	((((lo) >> IR_BIN_SHIFT) <= (k)) && (((hi) >> IR_BIN_SHIFT) >= (k)))
+
+#if IR_PROTO_NEC_ENABLE
+# define IR_BIN_NEC(k) \
+	(IR_BIN_HIT(k, IR_LO(IR_NEC_MARK), IR_HI(IR_NEC_MARK)) << IR_T_NEC)
+#else
+# define IR_BIN_NEC(k) 0
+#endif
+#if IR_PROTO_SAMSUNG_ENABLE
+# define IR_BIN_SAMSUNG(k) \
+	(IR_BIN_HIT(k, IR_LO(IR_SAMSUNG_MARK), IR_HI(IR_SAMSUNG_MARK)) << IR_T_SAMSUNG)
+#else
+# define IR_BIN_SAMSUNG(k) 0
+#endif
+#if IR_PROTO_SIRC_ENABLE
+# define IR_BIN_SIRC(k) \
+	(IR_BIN_HIT(k, IR_LO(IR_SIRC_MARK), IR_HI(IR_SIRC_MARK)) << IR_T_SIRC)
+#else
+# define IR_BIN_SIRC(k) 0
+#endif
+#if IR_PROTO_RC6_ENABLE
+# define IR_BIN_RC6(k) \
+	(IR_BIN_HIT(k, IR_LO(IR_RC6_MARK), IR_HI(IR_RC6_MARK)) << IR_T_RC6)
+#else
+# define IR_BIN_RC6(k) 0
+#endif
+#if IR_PROTO_RC5_ENABLE
+/* No header: the first mark is one or two units */
+# define IR_BIN_RC5(k) \
+	(IR_BIN_HIT(k, IR_LO(IR_RC5_UNIT), IR_HI(2 * IR_RC5_UNIT)) << IR_T_RC5)
+#else
+# define IR_BIN_RC5(k) 0
+#endif
+
+#define IR_BIN(k) (IR_BIN_NEC(k) | IR_BIN_SAMSUNG(k) | IR_BIN_SIRC(k) | \
+                   IR_BIN_RC6(k) | IR_BIN_RC5(k))
+#define IR_BIN8(k) IR_BIN(k), IR_BIN(k + 1), IR_BIN(k + 2), IR_BIN(k + 3), \
+                   IR_BIN(k + 4), IR_BIN(k + 5), IR_BIN(k + 6), IR_BIN(k + 7)
+
+static const uint8_t ir_bins[IR_BINS] PROGMEM = {
+	IR_BIN8(0), IR_BIN8(8), IR_BIN8(16), IR_BIN8(24), IR_BIN8(32), IR_BIN8(40),
+};
+
+#define IR_PROTOCOL_COUNT (sizeof(ir_protocols) / sizeof(ir_protocols[0]))
+
+/* Every leader window fits into the bins, a bin mask holds all templates */
+typedef char ir_bins_too_few[(IR_HI(IR_NEC_MARK) >> IR_BIN_SHIFT) < IR_BINS ? 1 : -1];
+typedef char ir_bins_too_narrow[IR_PROTOCOL_COUNT <= 8 ? 1 : -1];
+
+#define DEC_STATE_IDLE   0 /* wait for the first mark */
+#define DEC_STATE_HEADER 1 /* first mark received, wait for the space */
+#define DEC_STATE_DATA   2
+#define DEC_STATE_SKIP   3 /* frame done or invalid, wait for reset */
+
+static struct {
+	uint8_t state;
+	uint8_t bits;
+	uint8_t half;       /* manchester: first half of a bit received */
+	uint8_t first;      /* manchester: level of the first half */
+	uint16_t mark;      /* first mark of the frame */
+	uint16_t th[6];     /* min. and max. of 1, 2 and 3 units */
+	uint32_t code;
+	uint32_t result;
+	struct ir_protocol p;
+} g_dec = {
+	.state = DEC_STATE_IDLE,
+	.p = {
+		.id = IR_PROTO_NONE,
+	},
+};
+
+static uint16_t ir_diff(const uint16_t ticks, const uint16_t ref);
+static uint16_t ir_window(const uint16_t ticks, const struct ir_window *w);
+static uint8_t ir_units(const uint16_t ticks);
+static uint16_t ir_calibrate(const struct ir_protocol *p, const uint16_t space);
+static void ir_select(const uint8_t index, const uint16_t unit);
+static uint8_t ir_header(const uint16_t space);
+static void ir_shift(const uint8_t bit);
+static uint8_t ir_manchester(const uint8_t level, uint8_t units);
+static uint8_t ir_data(const uint8_t level, const uint16_t ticks);
+static uint8_t ir_done(void);
+
+static uint16_t ir_diff(const uint16_t ticks, const uint16_t ref)
+{
+	return (ticks > ref) ? (ticks - ref) : (ref - ticks);
+}
+
+/* Distance from the window's reference, IR_NO_MATCH outside the window */
+static uint16_t ir_window(const uint16_t ticks, const struct ir_window *w)
+{
+	uint16_t ref = pgm_read_word(&w->ref);
+	uint16_t diff = ir_diff(ticks, ref);
+
+	return ((ref != 0) && (diff <= pgm_read_word(&w->tol))) ? diff : IR_NO_MATCH;
+}
+
+static uint8_t ir_units(const uint16_t ticks)
+{
+	for (uint8_t n = 0; n < 6; n += 2) {
+		if (ticks <= g_dec.th[n + 1]) {
+			return (ticks >= g_dec.th[n]) ? ((n >> 1) + 1) : 0;
+		}
+	}
+	return 0;
+}
+
+/* Unit of this frame, measured from the first mark and space */
+static uint16_t ir_calibrate(const struct ir_protocol *p, const uint16_t space)
+{
+#if IR_CALIBRATE
+	uint32_t sum = (uint32_t)g_dec.mark + space;
+
+	return (uint16_t)((sum * pgm_read_word(&p->cal)) >> 16);
+#else
+	return pgm_read_word(&p->unit);
+#endif
+}
+
+static void ir_select(const uint8_t index, const uint16_t unit)
+{
+	uint16_t tol = unit >> IR_TOL_SHIFT;
+	uint16_t ref = unit;
+
+	memcpy_P(&g_dec.p, &ir_protocols[index].p, sizeof(g_dec.p));
+	g_dec.p.unit = unit;
+
+	for (uint8_t n = 0; n < 6; n += 2) {
+		g_dec.th[n] = ref - tol;
+		g_dec.th[n + 1] = ref + tol;
+		ref += unit;
+	}
+
+	g_dec.bits = 0;
+	g_dec.half = 0;
+	g_dec.code = 0;
+}
+
+/* Match the first mark/space pair against the templates of its leader bin,
+ * the closest header wins (SIRC and RC6 headers overlap on drifting remotes) */
+static uint8_t ir_header(const uint16_t space)
+{
+	const struct ir_template *t;
+	uint16_t best = IR_NO_MATCH;
+	uint8_t index = 0;
+	uint8_t bare = IR_PROTOCOL_COUNT;
+	uint8_t ret = IR_DECODE_ERROR;
+	uint8_t mask;
+
+	if ((g_dec.mark >> IR_BIN_SHIFT) >= IR_BINS) {
+		return IR_DECODE_ERROR;
+	}
+	mask = pgm_read_byte(&ir_bins[g_dec.mark >> IR_BIN_SHIFT]);
+
+	for (uint8_t i = 0; mask != 0; ++i, mask >>= 1) {
+		uint8_t match = IR_DECODE_BUSY;
+		uint16_t err;
+		uint16_t mark;
+
+		if (!(mask & 1)) {
+			continue;
+		}
+		t = &ir_protocols[i];
+		if (pgm_read_byte(&t->p.flags) & IR_F_NO_HEADER) {
+			bare = i;
+			continue;
+		}
+		mark = ir_window(g_dec.mark, &t->mark);
+		if (mark == IR_NO_MATCH) {
+			continue;
+		}
+		err = ir_window(space, &t->space);
+		if (err == IR_NO_MATCH) {
+			err = ir_window(space, &t->rpt);
+			match = IR_DECODE_REPEAT;
+		}
+		if (err == IR_NO_MATCH) {
+			continue;
+		}
+
+		err += mark;
+		if (err < best) {
+			best = err;
+			index = i;
+			ret = match;
+		}
+	}
+
+	if (ret == IR_DECODE_BUSY) {
+		ir_select(index, ir_calibrate(&ir_protocols[index].p, space));
+		return ret;
+	} else if (ret == IR_DECODE_REPEAT) {
+		ir_select(index, pgm_read_word(&ir_protocols[index].p.unit));
+		return ret;
+	} else if (bare == IR_PROTOCOL_COUNT) {
+		return IR_DECODE_ERROR;
+	}
+
+	/* No header: the idle line was the first half of a start bit, the
+	 * first mark and space are one or two units each */
+	t = &ir_protocols[bare];
+	if (ir_window(g_dec.mark, &t->mark) != IR_NO_MATCH) {
+		if (ir_window(space, &t->mark) != IR_NO_MATCH) {
+			ir_select(bare, ir_calibrate(&t->p, space));
+		} else if (ir_window(space, &t->space) != IR_NO_MATCH) {
+			ir_select(bare, pgm_read_word(&t->p.unit));
+		} else {
+			return IR_DECODE_ERROR;
+		}
+	} else if ((ir_window(g_dec.mark, &t->space) != IR_NO_MATCH) &&
+	           ((ir_window(space, &t->mark) != IR_NO_MATCH) ||
+	            (ir_window(space, &t->space) != IR_NO_MATCH))) {
+		ir_select(bare, pgm_read_word(&t->p.unit));
+	} else {
+		return IR_DECODE_ERROR;
+	}
+
+	g_dec.half = 1;
+	g_dec.first = IR_SPACE;
+	if (ir_data(IR_MARK, g_dec.mark) != IR_DECODE_BUSY) {
+		return IR_DECODE_ERROR;
+	}
+	return ir_data(IR_SPACE, space);
+}
+
+static void ir_shift(const uint8_t bit)
+{
+	if (g_dec.p.flags & IR_F_LSB_FIRST) {
+		g_dec.code >>= 1;
+		if (bit) {
+			g_dec.code |= 0x80000000UL;
+		}
+	} else {
+		g_dec.code <<= 1;
+		if (bit) {
+			g_dec.code |= 1;
+		}
+	}
+	++g_dec.bits;
+}
+
+static uint8_t ir_manchester(const uint8_t level, uint8_t units)
+{
+	while (units > 0) {
+		uint8_t width = (g_dec.bits == g_dec.p.trailer) ? 2 : 1;
+
+		if ((units < width) || (g_dec.bits >= g_dec.p.bits)) {
+			return IR_DECODE_ERROR;
+		}
+		units -= width;
+
+		if (!g_dec.half) {
+			g_dec.first = level;
+			g_dec.half = 1;
+		} else if (g_dec.first == level) {
+			return IR_DECODE_ERROR;
+		} else {
+			g_dec.half = 0;
+			ir_shift((g_dec.p.flags & IR_F_MARK_FIRST) ?
+			         (g_dec.first == IR_MARK) : (level == IR_MARK));
+		}
+	}
+
+	/* A trailing space can't be measured, the idle line completes the bit */
+	if ((level == IR_MARK) && g_dec.half &&
+	    (g_dec.bits == (g_dec.p.bits - 1))) {
+		g_dec.half = 0;
+		ir_shift(g_dec.p.flags & IR_F_MARK_FIRST);
+	}
+
+	return IR_DECODE_BUSY;
+}
+
+static uint8_t ir_data(const uint8_t level, const uint16_t ticks)
+{
+	uint8_t units = ir_units(ticks);
+
+	if (units == 0) {
+		return IR_DECODE_ERROR;
+	}
+
+	switch (g_dec.p.coding) {
+	case IR_CODING_DISTANCE:
+		if (level == IR_MARK) {
+			return (units == 1) ? IR_DECODE_BUSY : IR_DECODE_ERROR;
+		}
+		if (units == 2) {
+			return IR_DECODE_ERROR;
+		}
+		ir_shift(units == 3);
+		break;
+	case IR_CODING_WIDTH:
+		if (level == IR_SPACE) {
+			return (units == 1) ? IR_DECODE_BUSY : IR_DECODE_ERROR;
+		}
+		if (units == 3) {
+			return IR_DECODE_ERROR;
+		}
+		ir_shift(units == 2);
+		break;
+	default:
+		if (ir_manchester(level, units) != IR_DECODE_BUSY) {
+			return IR_DECODE_ERROR;
+		}
+		break;
+	}
+
+	return (g_dec.bits == g_dec.p.bits) ? ir_done() : IR_DECODE_BUSY;
+}
+
+static uint8_t ir_done(void)
+{
+	uint32_t code = g_dec.code;
+
+	if (g_dec.p.flags & IR_F_LSB_FIRST) {
+		code >>= (32 - g_dec.p.bits);
+	}
+	g_dec.result = code & ~g_dec.p.toggle;
+	g_dec.state = DEC_STATE_SKIP;
+
+	return IR_DECODE_DONE;
+}
+
+void ir_decode_reset(void)
+{
+	g_dec.state = DEC_STATE_IDLE;
+}
+
+uint8_t ir_decode_edge(const uint8_t level, const uint16_t ticks)
+{
+	uint8_t ret = IR_DECODE_BUSY;
+
+	switch (g_dec.state) {
+	case DEC_STATE_IDLE:
+		if (level == IR_MARK) {
+			g_dec.mark = ticks;
+			g_dec.state = DEC_STATE_HEADER;
+		}
+		return IR_DECODE_BUSY;
+	case DEC_STATE_HEADER:
+		ret = ir_header(ticks);
+		if (ret == IR_DECODE_BUSY) {
+			g_dec.state = DEC_STATE_DATA;
+		} else if (ret == IR_DECODE_REPEAT) {
+			g_dec.state = DEC_STATE_SKIP;
+		}
+		break;
+	case DEC_STATE_DATA:
+		ret = ir_data(level, ticks);
+		break;
+	default:
+		return IR_DECODE_BUSY;
+	}
+
+	if (ret == IR_DECODE_ERROR) {
+		g_dec.state = DEC_STATE_SKIP;
+	}
+
+	return ret;
+}
+
+uint8_t ir_decode_pending(void)
+{
+	return (g_dec.state != DEC_STATE_IDLE) ? 1 : 0;
+}
+
+uint32_t ir_decode_code(void)
+{
+	return g_dec.result;
+}
+
+uint8_t ir_decode_proto(void)
+{
+	return g_dec.p.id;
+}
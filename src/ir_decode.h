@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+/* Protocols compiled into the decoder (see ir_decode.c for the timings) */
+#ifndef IR_PROTO_NEC_ENABLE
+# define IR_PROTO_NEC_ENABLE 1
+#endif
+#ifndef IR_PROTO_SAMSUNG_ENABLE
+# define IR_PROTO_SAMSUNG_ENABLE 1
+#endif
+#ifndef IR_PROTO_SIRC_ENABLE
+# define IR_PROTO_SIRC_ENABLE 1
+#endif
+#ifndef IR_PROTO_RC6_ENABLE
+# define IR_PROTO_RC6_ENABLE 1
+#endif
+#ifndef IR_PROTO_RC5_ENABLE
+# define IR_PROTO_RC5_ENABLE 1
+#endif
+
+/*! Derive the unit of each frame from its leader instead of the template */
+#ifndef IR_CALIBRATE
+# define IR_CALIBRATE 1
+#endif
+
+/*! Durations within +-(unit >> IR_TOL_SHIFT) of 1, 2 or 3 units are
+ *  accepted; 1 splits halfway between them, larger values are stricter */
+#ifndef IR_TOL_SHIFT
+# define IR_TOL_SHIFT 1
+#endif
+
+/*! Convert microseconds to Timer 1 ticks (clk/8) */
+#define IR_US(us) ((uint16_t)((us) * (F_CPU / 1000000UL) / 8))
+
+/*! No edge for this long ends a frame (longer than any mark or space) */
+#define IR_TIMEOUT IR_US(12000)
+
+/*! Level of the IR signal during a captured duration */
+#define IR_SPACE 0
+#define IR_MARK 1
+
+/*! Frame is not complete yet */
+#define IR_DECODE_BUSY 0
+/*! Last bit of a frame has been received */
+#define IR_DECODE_DONE 1
+/*! Frame doesn't match any enabled protocol (ignored until reset) */
+#define IR_DECODE_ERROR 2
+/*! Repeat frame: the last key is still held (code is unchanged) */
+#define IR_DECODE_REPEAT 3
+
+enum ir_proto {
+	IR_PROTO_NEC = 0,
+	IR_PROTO_SAMSUNG,
+	IR_PROTO_SIRC,
+	IR_PROTO_RC6,
+	IR_PROTO_RC5,
+	IR_PROTO_NONE = 0xff,
+};
+
+void ir_decode_reset(void);
+uint8_t ir_decode_edge(const uint8_t level, const uint16_t ticks);
+uint8_t ir_decode_pending(void);
+uint32_t ir_decode_code(void);
+uint8_t ir_decode_proto(void);
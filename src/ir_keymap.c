@@ -0,0 +1,238 @@
+#include <avr/pgmspace.h>
+#include <avr/eeprom.h>
+#include <string.h>
+
+#include "ir_decode.h"
+#include "ir_keymap.h"
+
+/* Code to action tables
+ *
+ * The built-in table lives in flash, keys learned at runtime are kept in
+ * EEPROM. Both MUST be sorted by code (and protocol for equal codes).
+ * ir_keymap_lookup() does a binary search with a fixed number of steps on
+ * each, so every lookup costs the same no matter how many keys are mapped.
+ * Learned keys take precedence over built-in ones.
+ */
+static const struct ir_key ir_keymap[] PROGMEM = {
+	/* Pioneer: "Ein" (a6591ce3 is "Aus") shares this code, quiet wins */
+	{ IR_CODE(0xa6, 0x59, 0xd8, 0x27), IR_PROTO_NEC, IR_ACT_PRESET, 150 },
+	{ IR_CODE(0xa6, 0x59, 0xd7, 0x28), IR_PROTO_NEC, IR_ACT_PRESET, 192 },
+	{ IR_CODE(0xa6, 0x59, 0x4c, 0xb3), IR_PROTO_NEC, IR_ACT_INPUT, 1 },
+	{ IR_CODE(0xa6, 0x59, 0x49, 0xb6), IR_PROTO_NEC, IR_ACT_INPUT, 3 },
+	{ IR_CODE(0xa4, 0x5b, 0x1e, 0xe1), IR_PROTO_NEC, IR_ACT_MUTE, 0 },
+	{ IR_CODE(0xa6, 0x59, 0x1c, 0xe3), IR_PROTO_NEC, IR_ACT_POWER_OFF, 0 },
+	{ IR_CODE(0xa6, 0x59, 0x0f, 0xf0), IR_PROTO_NEC, IR_ACT_INPUT, 2 },
+	{ IR_CODE(0xa6, 0x59, 0x0b, 0xf4), IR_PROTO_NEC, IR_ACT_VOL_DOWN, 0 },
+	{ IR_CODE(0xa6, 0x59, 0x0a, 0xf5), IR_PROTO_NEC, IR_ACT_VOL_UP, 0 },
+};
+
+#define IR_KEYMAP_SIZE (sizeof(ir_keymap) / sizeof(ir_keymap[0]))
+
+typedef char ir_keymap_too_large[(IR_KEYMAP_SIZE <= IR_KEYMAP_MAX) ? 1 : -1];
+typedef char ir_learn_not_power_of_two[((IR_LEARN_MAX & (IR_LEARN_MAX - 1)) == 0) ? 1 : -1];
+
+/* Changes whenever the EEPROM layout does */
+#define IR_LEARN_MAGIC 0xa2
+
+/* Learned keys: lookups and changes use the RAM copy, changed bytes are
+ * written back one at a time by ir_keymap_commit() */
+struct ir_learned {
+	uint8_t magic;
+	uint8_t count;
+	struct ir_key keys[IR_LEARN_MAX];
+};
+
+static struct ir_learned EEMEM ee_learned;
+
+static struct {
+	struct ir_learned map;
+	uint16_t dirty;     /* first byte that may differ from the EEPROM */
+	uint16_t dirty_end; /* end of that range, dirty == dirty_end: none */
+} g_learn = {
+	.dirty = 0,
+	.dirty_end = 0,
+};
+
+/* Bytes [from, from + len) of the RAM copy have changed */
+static void ir_learned_dirty(const void *from, const uint16_t len)
+{
+	uint16_t start = (const uint8_t *)from - (const uint8_t *)&g_learn.map;
+	uint16_t end = start + len;
+
+	if (g_learn.dirty == g_learn.dirty_end) {
+		g_learn.dirty = start;
+		g_learn.dirty_end = end;
+		return;
+	}
+	if (start < g_learn.dirty) {
+		g_learn.dirty = start;
+	}
+	if (end > g_learn.dirty_end) {
+		g_learn.dirty_end = end;
+	}
+}
+
+typedef uint8_t (*ir_key_le_t)(const uint16_t index, const uint32_t code, const uint8_t proto);
+
+/* Is entry index <= (code, proto)? */
+static uint8_t ir_key_le(const uint16_t index, const uint32_t code, const uint8_t proto)
+{
+	uint32_t tmp = pgm_read_dword(&ir_keymap[index].code);
+
+	if (tmp != code) {
+		return (tmp < code) ? 1 : 0;
+	}
+	return (pgm_read_byte(&ir_keymap[index].proto) <= proto) ? 1 : 0;
+}
+
+/* Is learned entry index <= (code, proto)? */
+static uint8_t ir_learned_le(const uint16_t index, const uint32_t code, const uint8_t proto)
+{
+	uint32_t tmp = g_learn.map.keys[index].code;
+
+	if (tmp != code) {
+		return (tmp < code) ? 1 : 0;
+	}
+	return (g_learn.map.keys[index].proto <= proto) ? 1 : 0;
+}
+
+/* Index of the last entry <= (code, proto), 0 if there is none */
+static uint16_t ir_search(ir_key_le_t le, const uint16_t size, const uint16_t max,
+                          const uint32_t code, const uint8_t proto)
+{
+	uint16_t base = 0;
+
+	for (uint16_t step = max / 2; step > 0; step >>= 1) {
+		uint16_t probe = base + step;
+
+		if ((probe < size) && le(probe, code, proto)) {
+			base = probe;
+		}
+	}
+	return base;
+}
+
+static uint8_t ir_key_equal(const struct ir_key *key, const uint32_t code, const uint8_t proto)
+{
+	return ((key->code == code) && (key->proto == proto)) ? 1 : 0;
+}
+
+void ir_keymap_init(void)
+{
+	eeprom_read_block(&g_learn.map, &ee_learned, sizeof(g_learn.map));
+	if ((g_learn.map.magic != IR_LEARN_MAGIC) || (g_learn.map.count > IR_LEARN_MAX)) {
+		ir_keymap_clear();
+	}
+}
+
+uint8_t ir_keymap_lookup(const uint32_t code, const uint8_t proto, struct ir_key *key)
+{
+	uint16_t base;
+
+	if (g_learn.map.count > 0) {
+		base = ir_search(ir_learned_le, g_learn.map.count, IR_LEARN_MAX, code, proto);
+		*key = g_learn.map.keys[base];
+		if (ir_key_equal(key, code, proto)) {
+			return 1;
+		}
+	}
+
+	base = ir_search(ir_key_le, IR_KEYMAP_SIZE, IR_KEYMAP_MAX, code, proto);
+	memcpy_P(key, &ir_keymap[base], sizeof(*key));
+
+	return ir_key_equal(key, code, proto);
+}
+
+/* Store (or replace) a learned key, keeps the table sorted */
+int8_t ir_keymap_learn(const struct ir_key *key)
+{
+	struct ir_key *keys = g_learn.map.keys;
+	uint8_t pos = 0;
+
+	if (g_learn.map.count > 0) {
+		pos = ir_search(ir_learned_le, g_learn.map.count, IR_LEARN_MAX, key->code, key->proto);
+		if (ir_key_equal(&keys[pos], key->code, key->proto)) {
+			keys[pos] = *key;
+			ir_learned_dirty(&keys[pos], sizeof(*key));
+			return 0;
+		}
+		if (ir_learned_le(pos, key->code, key->proto)) {
+			++pos;
+		}
+	}
+
+	if (g_learn.map.count >= IR_LEARN_MAX) {
+		return -ENOSPC;
+	}
+
+	memmove(&keys[pos + 1], &keys[pos], (g_learn.map.count - pos) * sizeof(*key));
+	keys[pos] = *key;
+	ir_learned_dirty(&keys[pos], (g_learn.map.count - pos + 1) * sizeof(*key));
+
+	++g_learn.map.count;
+	ir_learned_dirty(&g_learn.map.count, 1);
+
+	return 0;
+}
+
+int8_t ir_keymap_forget(const uint32_t code, const uint8_t proto)
+{
+	struct ir_key *keys = g_learn.map.keys;
+	uint8_t pos;
+
+	if (g_learn.map.count == 0) {
+		return -ENOENT;
+	}
+
+	pos = ir_search(ir_learned_le, g_learn.map.count, IR_LEARN_MAX, code, proto);
+	if (!ir_key_equal(&keys[pos], code, proto)) {
+		return -ENOENT;
+	}
+
+	--g_learn.map.count;
+	ir_learned_dirty(&g_learn.map.count, 1);
+	memmove(&keys[pos], &keys[pos + 1], (g_learn.map.count - pos) * sizeof(*keys));
+	ir_learned_dirty(&keys[pos], (g_learn.map.count - pos) * sizeof(*keys));
+
+	return 0;
+}
+
+void ir_keymap_clear(void)
+{
+	g_learn.map.count = 0;
+	g_learn.map.magic = IR_LEARN_MAGIC;
+	ir_learned_dirty(&g_learn.map, 2);
+}
+
+uint8_t ir_keymap_learned(void)
+{
+	return g_learn.map.count;
+}
+
+/* Write at most one changed byte back to the EEPROM, never waits for a
+ * write in progress (3.4ms each) */
+void ir_keymap_commit(void)
+{
+	const uint8_t *ram = (const uint8_t *)&g_learn.map;
+	uint8_t *ee = (uint8_t *)&ee_learned;
+
+	while (g_learn.dirty != g_learn.dirty_end) {
+		uint16_t i = g_learn.dirty;
+
+		if (!eeprom_is_ready()) {
+			return;
+		}
+		if (eeprom_read_byte(&ee[i]) != ram[i]) {
+			eeprom_write_byte(&ee[i], ram[i]);
+			++g_learn.dirty;
+			break;
+		}
+		++g_learn.dirty;
+	}
+}
+
+/* Changed bytes are waiting for ir_keymap_commit() */
+uint8_t ir_keymap_busy(void)
+{
+	return (g_learn.dirty != g_learn.dirty_end) ? 1 : 0;
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include "error_codes.h"
+
+/*! Build a 32 bit code from the bytes in the order they are received */
+#define IR_CODE(b0,b1,b2,b3) ( ((uint32_t)(b3) << 24) \
+                             | ((uint32_t)(b2) << 16) \
+                             | ((uint32_t)(b1) << 8) \
+                             | ((uint32_t)(b0)) )
+
+/*! Upper bound of the keymap size, lookups always take log2(max) steps */
+#define IR_KEYMAP_MAX 256
+
+/*! Number of learned keys stored in EEPROM (7 bytes each), power of two */
+#ifndef IR_LEARN_MAX
+# define IR_LEARN_MAX 32
+#endif
+
+enum ir_action {
+	IR_ACT_NONE = 0,
+	IR_ACT_VOL_UP,
+	IR_ACT_VOL_DOWN,
+	IR_ACT_MUTE,
+	IR_ACT_PRESET,   /* arg: volume */
+	IR_ACT_POWER_ON,
+	IR_ACT_POWER_OFF,
+	IR_ACT_INPUT,    /* arg: input jack (1..3) */
+	IR_ACT_MEDIA,    /* arg: media key (enum ir_media) */
+	IR_ACT_COUNT,
+};
+
+/* Media keys sent as HID Consumer usages (see act_media) */
+enum ir_media {
+	IR_MEDIA_PLAY_PAUSE = 0,
+	IR_MEDIA_NEXT,
+	IR_MEDIA_PREVIOUS,
+	IR_MEDIA_STOP,
+	IR_MEDIA_PLAY,
+	IR_MEDIA_PAUSE,
+	IR_MEDIA_MUTE,
+	IR_MEDIA_VOL_UP,
+	IR_MEDIA_VOL_DOWN,
+	IR_MEDIA_HOME,
+	IR_MEDIA_BACK,
+	IR_MEDIA_FORWARD,
+	IR_MEDIA_COUNT,
+};
+
+struct ir_key {
+	uint32_t code;
+	uint8_t proto;
+	uint8_t action;
+	uint8_t arg;
+};
+
+void ir_keymap_init(void);
+uint8_t ir_keymap_lookup(const uint32_t code, const uint8_t proto, struct ir_key *key);
+int8_t ir_keymap_learn(const struct ir_key *key);
+int8_t ir_keymap_forget(const uint32_t code, const uint8_t proto);
+void ir_keymap_clear(void);
+uint8_t ir_keymap_learned(void);
+void ir_keymap_commit(void);
+uint8_t ir_keymap_busy(void);
@@ -0,0 +1,94 @@
+#include <stddef.h>
+#include <util/atomic.h>
+#include <LUFA/Drivers/Board/LEDs.h>
+
+#include "timer.h"
+#include "led.h"
+
+/* Tick period in Timer 1 ticks */
+#define LED_TICK TIMER_MS(10)
+
+/* Shared with the tick (timer interrupt); patterns are also set from USB event handlers
+ * that run in interrupt context, so every update is atomic. */
+static struct {
+	const struct led_step *start;
+	const struct led_step *step; /* NULL: static */
+	uint8_t left;                /* ticks left in this step */
+	uint8_t leds;                /* mask of the current step */
+	uint8_t flash;               /* toggled on top of leds */
+	uint8_t flash_left;
+} g_led = {
+	.start = NULL,
+	.step = NULL,
+	.left = 0,
+	.leds = 0,
+	.flash = 0,
+	.flash_left = 0,
+};
+
+static void led_load(const struct led_step *step);
+static void led_update(void);
+static void led_tick(void);
+
+/* Enter a step, follow LED_END (interrupts disabled) */
+static void led_load(const struct led_step *step)
+{
+	uint8_t time = pgm_read_byte(&step->time);
+
+	if (time == 0) {
+		if ((pgm_read_byte(&step->leds) != LED_REPEAT) || (step == g_led.start)) {
+			g_led.step = NULL; /* hold the current mask */
+			return;
+		}
+		step = g_led.start;
+		time = pgm_read_byte(&step->time);
+	}
+	g_led.step = step;
+	g_led.left = time;
+	g_led.leds = pgm_read_byte(&step->leds);
+}
+
+/* Show the LEDs, run the tick only while something changes (interrupts disabled) */
+static void led_update(void)
+{
+	LEDs_SetAllLEDs(g_led.leds ^ g_led.flash);
+
+	if ((g_led.step == NULL) && (g_led.flash_left == 0)) {
+		timer_cancel(TIMER_SLOT_LED);
+	} else if (!timer_pending(TIMER_SLOT_LED)) {
+		timer_start(TIMER_SLOT_LED, LED_TICK, LED_TICK, led_tick);
+	}
+}
+
+/* Timer callback (interrupt context) */
+static void led_tick(void)
+{
+	if ((g_led.flash_left > 0) && (--g_led.flash_left == 0)) {
+		g_led.flash = 0;
+	}
+	if ((g_led.step != NULL) && (--g_led.left == 0)) {
+		led_load(g_led.step + 1);
+	}
+	led_update();
+}
+
+/* Start a pattern (replaces the running one) */
+void led_pattern(const struct led_step *pattern)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		g_led.start = pattern;
+		g_led.leds = 0;
+		led_load(pattern);
+		led_update();
+	}
+}
+
+/* Toggle leds on top of the pattern for time ticks */
+void led_flash(const uint8_t leds, const uint8_t time)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		g_led.flash = (time > 0) ? leds : 0;
+		g_led.flash_left = time;
+		led_update();
+	}
+}
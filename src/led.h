@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+/* LED patterns, advanced by a 10ms software timer (TIMER_SLOT_LED)
+ *
+ * A pattern is a PROGMEM array of steps (LED mask, duration), ended by
+ * LED_END(): the last mask is held, or the pattern starts over with
+ * LED_REPEAT. Nothing blocks; the tick timer only runs while a pattern
+ * or a flash is running, so static LEDs don't wake the CPU.
+ * A flash toggles LEDs on top of the pattern for a while (IR activity).
+ */
+
+/*! Step duration in 10ms ticks (1..255, i.e. up to 2.55s) */
+#define LED_MS(ms) ((uint8_t)((ms) / 10))
+
+#define LED_HOLD   0
+#define LED_REPEAT 1
+
+/*! Last entry of a pattern (LED_HOLD or LED_REPEAT) */
+#define LED_END(how) { (how), 0 }
+
+struct led_step {
+	uint8_t leds;
+	uint8_t time;
+};
+
+void led_pattern(const struct led_step *pattern);
+void led_flash(const uint8_t leds, const uint8_t time);
@@ -0,0 +1,220 @@
+#include <stdarg.h>
+#include <string.h>
+
+#include "cdc_tx.h"
+#include "log.h"
+
+#define LOG_LEN_INT  0 /* no modifier, 16 bit */
+#define LOG_LEN_CHAR 1 /* hh */
+#define LOG_LEN_LONG 2 /* l */
+
+struct log_buf {
+	uint8_t len;
+	uint8_t data[LOG_LINE_MAX];
+};
+
+static void log_putc(struct log_buf *b, const uint8_t c)
+{
+	if (b->len < LOG_LINE_MAX) {
+		b->data[b->len++] = c;
+	}
+}
+
+static void log_number(struct log_buf *b, uint32_t value, const uint8_t hex,
+                       const uint8_t upper, const uint8_t neg,
+                       uint8_t width, const uint8_t zero)
+{
+	char digits[10];
+	uint8_t n = 0;
+
+	do {
+		uint8_t d;
+
+		if (hex) {
+			d = value & 0xf;
+			value >>= 4;
+		} else if (value <= 0xffff) {
+			/* 16 bit division is a lot cheaper on AVR */
+			d = (uint16_t)value % 10;
+			value = (uint16_t)value / 10;
+		} else {
+			d = value % 10;
+			value /= 10;
+		}
+		digits[n++] = (d < 10) ? ('0' + d) : ((upper ? 'A' : 'a') + d - 10);
+	} while (value != 0);
+
+	if (neg) {
+		if (width > 0) {
+			--width;
+		}
+		if (zero) {
+			log_putc(b, '-');
+		}
+	}
+	while (width > n) {
+		log_putc(b, zero ? '0' : ' ');
+		--width;
+	}
+	if (neg && !zero) {
+		log_putc(b, '-');
+	}
+	while (n > 0) {
+		log_putc(b, digits[--n]);
+	}
+}
+
+/* Text: format the arguments, trace: copy them (little endian) */
+static void log_format(struct log_buf *b, PGM_P fmt, va_list ap, const uint8_t trace)
+{
+	char c;
+
+	while ((c = pgm_read_byte(fmt++)) != '\0') {
+		uint8_t zero = 0;
+		uint8_t width = 0;
+		uint8_t len = LOG_LEN_INT;
+		uint32_t value = 0;
+		uint8_t neg = 0;
+
+		if (c != '%') {
+			if (!trace) {
+				log_putc(b, c);
+			}
+			continue;
+		}
+
+		c = pgm_read_byte(fmt++);
+		if (c == '0') {
+			zero = 1;
+			c = pgm_read_byte(fmt++);
+		}
+		while ((c >= '0') && (c <= '9')) {
+			width = width * 10 + (c - '0');
+			c = pgm_read_byte(fmt++);
+		}
+		if (c == 'h') {
+			c = pgm_read_byte(fmt++);
+			if (c == 'h') {
+				len = LOG_LEN_CHAR;
+				c = pgm_read_byte(fmt++);
+			}
+		} else if (c == 'l') {
+			len = LOG_LEN_LONG;
+			c = pgm_read_byte(fmt++);
+		}
+
+		if (c == '\0') {
+			return;
+		}
+
+		switch (c) {
+		case 'd':
+		case 'u':
+		case 'x':
+		case 'X':
+			if (len == LOG_LEN_LONG) {
+				value = va_arg(ap, uint32_t);
+			} else {
+				value = (uint16_t)va_arg(ap, int);
+				if (len == LOG_LEN_CHAR) {
+					value &= 0xff;
+				}
+			}
+
+			if (trace) {
+				log_putc(b, value);
+				if (len != LOG_LEN_CHAR) {
+					log_putc(b, value >> 8);
+				}
+				if (len == LOG_LEN_LONG) {
+					log_putc(b, value >> 16);
+					log_putc(b, value >> 24);
+				}
+				break;
+			}
+
+			if (c == 'd') {
+				uint32_t sign = (len == LOG_LEN_LONG) ? 0x80000000UL :
+				                (len == LOG_LEN_CHAR) ? 0x80 : 0x8000;
+
+				if (value & sign) {
+					neg = 1;
+					value = ((sign << 1) - value) & ((sign << 1) - 1);
+				}
+			}
+			log_number(b, value, (c == 'x') || (c == 'X'), c == 'X', neg, width, zero);
+			break;
+		case 'c':
+			log_putc(b, va_arg(ap, int));
+			break;
+		case 's': {
+			const char *s = va_arg(ap, const char *);
+
+			while (*s != '\0') {
+				log_putc(b, *s++);
+			}
+			if (trace) {
+				log_putc(b, '\0');
+			}
+			break;
+		}
+		case '%':
+			if (!trace) {
+				log_putc(b, '%');
+			}
+			break;
+		default:
+			/* Unsupported conversion: print it as is */
+			if (!trace) {
+				log_putc(b, '%');
+				log_putc(b, c);
+			}
+			break;
+		}
+	}
+}
+
+/* Log message (log channel), a trace packet with LOG_TRACE */
+void log_P(PGM_P fmt, ...)
+{
+	struct log_buf b = { .len = 0 };
+	va_list ap;
+
+	va_start(ap, fmt);
+#if LOG_TRACE
+	{
+		uint16_t id = (uint16_t)(uintptr_t)fmt;
+
+		/* Header first, the payload length is filled in below */
+		log_putc(&b, 0x00);
+		log_putc(&b, 'T');
+		log_putc(&b, 0);
+		log_putc(&b, 0);
+		log_putc(&b, id);
+		log_putc(&b, id >> 8);
+		log_format(&b, fmt, ap, 1);
+		b.data[2] = b.len - 4;
+
+		/* Whole packet or nothing, counted as dropped by cdc_tx */
+		cdc_tx_write(CDC_TX_LOG, b.data, b.len);
+	}
+#else
+	log_format(&b, fmt, ap, 0);
+	cdc_tx_write(CDC_TX_LOG, b.data, b.len);
+#endif
+	va_end(ap);
+}
+
+/* Always text on the control channel, for messages parsed by the host
+ * (IR:...#, VOL:...#) */
+void log_text_P(PGM_P fmt, ...)
+{
+	struct log_buf b = { .len = 0 };
+	va_list ap;
+
+	va_start(ap, fmt);
+	log_format(&b, fmt, ap, 0);
+	va_end(ap);
+
+	cdc_tx_write(CDC_TX_CTRL, b.data, b.len);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdint.h>
+#include <avr/pgmspace.h>
+
+/* Small logger with format strings in flash
+ *
+ * Supports %d %u %x %X %c %s and %% with optional zero padding, width and
+ * the length modifiers hh, h and l (arguments are passed as on AVR: int is
+ * 16 bit). Every message is built completely and then written to the CDC
+ * TX buffer, so a full buffer drops whole messages. log_P() writes to the
+ * log channel, log_text_P() to the control channel (see cdc_tx.h).
+ *
+ * With LOG_TRACE=1 log_P() sends binary trace packets instead of text:
+ * the flash address of the format string and the raw arguments, formatted
+ * on the host by host/log_decode.py (see doc/raw.txt).
+ */
+
+#ifndef LOG_TRACE
+# define LOG_TRACE 0
+#endif
+
+/*! Longest message (text) or trace packet payload */
+#define LOG_LINE_MAX 64
+
+void log_P(PGM_P fmt, ...);
+void log_text_P(PGM_P fmt, ...);
@@ -1,7 +1,28 @@
+#include <stddef.h>
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
 
 #include "spi.h"
 
+#define SPI_QUEUE_MASK (SPI_QUEUE_SIZE - 1)
+
+typedef char spi_queue_not_power_of_two[((SPI_QUEUE_SIZE & SPI_QUEUE_MASK) == 0) ? 1 : -1];
+
+/* Transaction queue: the ISR works on ring[tail], spi_submit() adds at head */
+static struct {
+	struct spi_xfer ring[SPI_QUEUE_SIZE];
+	volatile uint8_t head;
+	volatile uint8_t tail;
+	uint8_t pos;  /* ISR: byte of ring[tail] being shifted */
+} g_spi = {
+	.head = 0,
+	.tail = 0,
+	.pos = 0,
+};
+
+static void spi_start(void);
+
 #undef SPI_USE_CS
 
 #ifdef SPI_USE_CS
@@ -28,7 +49,7 @@ void spi_init_master(void)
 
 	spi_chip_release();
 
-	// enable SPI, master, clock rate F_OSC/16, 
+	// enable SPI, master, clock rate F_OSC/128,
 	// CPOL = 0 CPHA = 0
 	SPCR = _BV(SPE) | _BV(MSTR) | _BV(SPR0) | _BV(SPR1);
 
@@ -93,3 +114,74 @@ uint16_t spi_wtransfer(const uint16_t data)
 
 	return (data_hi << 8) | (data_lo);
 }
+
+/* Select the device and send the first byte of ring[tail] (interrupts disabled) */
+static void spi_start(void)
+{
+	struct spi_xfer *x = &g_spi.ring[g_spi.tail];
+
+	g_spi.pos = 0;
+	if (x->cs != NULL) {
+		x->cs(1);
+	}
+	(void)SPSR; /* a stale SPIF is cleared by the SPDR write */
+	SPCR |= _BV(SPIE);
+	SPDR = x->data[0];
+}
+
+ISR(SPI_STC_vect)
+{
+	struct spi_xfer *x = &g_spi.ring[g_spi.tail];
+
+	x->data[g_spi.pos++] = SPDR;
+	if (g_spi.pos < x->len) {
+		SPDR = x->data[g_spi.pos];
+		return;
+	}
+
+	if (x->cs != NULL) {
+		x->cs(0);
+	}
+	if (x->done != NULL) {
+		x->done(x);
+	}
+
+	g_spi.tail = (g_spi.tail + 1) & SPI_QUEUE_MASK;
+	if (g_spi.tail != g_spi.head) {
+		spi_start();
+	} else {
+		SPCR &= ~_BV(SPIE);
+	}
+}
+
+/* Queue a transaction (copied), returns -ENOSPC if the queue is full */
+int8_t spi_submit(const struct spi_xfer *x)
+{
+	int8_t ret = 0;
+
+	if ((x->len == 0) || (x->len > SPI_XFER_MAX)) {
+		return -EINVAL;
+	}
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		uint8_t head = g_spi.head;
+		uint8_t next = (head + 1) & SPI_QUEUE_MASK;
+
+		if (next == g_spi.tail) {
+			ret = -ENOSPC;
+		} else {
+			g_spi.ring[head] = *x;
+			g_spi.head = next;
+			if (head == g_spi.tail) {
+				spi_start(); /* queue was idle */
+			}
+		}
+	}
+	return ret;
+}
+
+/* Transactions waiting or in progress? */
+uint8_t spi_busy(void)
+{
+	return (g_spi.head != g_spi.tail) ? 1 : 0;
+}
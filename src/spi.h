@@ -1,6 +1,8 @@
 #pragma once
 
+#include <stdint.h>
 #include "pin_io.h"
+#include "error_codes.h"
 
 #define SPI_MISO(op)     PIN_MAKE(B,3,op)
 #define SPI_MOSI(op)     PIN_MAKE(B,2,op)
@@ -8,7 +10,38 @@
 #define SPI_SS(op)       PIN_MAKE(B,0,op)
 
 
+/* Asynchronous transfers
+ *
+ * spi_submit() copies a transaction into a queue and returns at once; the
+ * SPI_STC interrupt shifts the bytes, drives the chip select through the
+ * cs callback and calls done with the received bytes in data. Both
+ * callbacks run in interrupt context. The busy-wait spi_btransfer() and
+ * spi_wtransfer() are kept for bring-up and must not be mixed with queued
+ * transfers.
+ */
+
+/*! Transactions waiting or in progress, power of two */
+#define SPI_QUEUE_SIZE 4
+
+/*! Bytes per transaction */
+#define SPI_XFER_MAX 4
+
+struct spi_xfer;
+
+/*! select != 0: assert the chip select of the device, 0: release it */
+typedef void (*spi_cs_t)(const uint8_t select);
+typedef void (*spi_done_t)(const struct spi_xfer *x);
+
+struct spi_xfer {
+	uint8_t len;
+	uint8_t data[SPI_XFER_MAX]; /* sent MSB first, replaced by the received bytes */
+	spi_cs_t cs;
+	spi_done_t done;            /* may be NULL */
+};
+
 void spi_init_master(void);
 void spi_shutdown(void);
 uint8_t spi_btransfer(const uint8_t data);
 uint16_t spi_wtransfer(const uint16_t data);
+int8_t spi_submit(const struct spi_xfer *x);
+uint8_t spi_busy(void);
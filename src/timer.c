@@ -0,0 +1,117 @@
+#include <stddef.h>
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+#include "timer.h"
+
+/* Compare values closer than this to TCNT1 may already have passed */
+#define TIMER_MIN_TICKS 32
+
+struct timer {
+	uint32_t due;    /* clock_now() time of expiry */
+	uint32_t period; /* 0: one-shot */
+	timer_callback_t cb;
+};
+
+/* Shared with the ISR, updated with interrupts disabled */
+static struct {
+	struct timer slot[TIMER_SLOTS];
+	uint8_t running; /* bit mask of slots */
+} g_timer = {
+	.running = 0,
+};
+
+typedef char timer_too_many_slots[(TIMER_SLOTS <= 8) ? 1 : -1];
+
+static void timer_arm(void);
+
+/* Program the compare unit to the earliest deadline (interrupts disabled) */
+static void timer_arm(void)
+{
+	uint32_t now;
+	uint32_t next = 0;
+	int32_t left = INT32_MAX;
+
+	if (g_timer.running == 0) {
+		TIMSK1 &= ~(1 << OCIE1B);
+		return;
+	}
+
+	now = clock_now();
+	for (uint8_t i = 0; i < TIMER_SLOTS; ++i) {
+		if ((g_timer.running & (1 << i)) &&
+		    ((int32_t)(g_timer.slot[i].due - now) < left)) {
+			left = g_timer.slot[i].due - now;
+			next = g_timer.slot[i].due;
+		}
+	}
+
+	/* More than one counter period away: the match comes early, the ISR
+	 * finds nothing due and arms again */
+	if (left < TIMER_MIN_TICKS) {
+		OCR1B = TCNT1 + TIMER_MIN_TICKS;
+	} else {
+		OCR1B = (uint16_t)next;
+	}
+	TIFR1 = (1 << OCF1B);
+	TIMSK1 |= (1 << OCIE1B);
+}
+
+ISR(TIMER1_COMPB_vect)
+{
+	uint32_t now;
+
+	now = clock_now();
+	for (uint8_t i = 0; i < TIMER_SLOTS; ++i) {
+		struct timer *t = &g_timer.slot[i];
+
+		if (!(g_timer.running & (1 << i)) || ((int32_t)(t->due - now) > 0)) {
+			continue;
+		}
+		if (t->period == 0) {
+			g_timer.running &= ~(1 << i);
+		} else {
+			t->due += t->period;
+			if ((int32_t)(t->due - now) <= 0) {
+				t->due = now + t->period; /* fell behind, skip ticks */
+			}
+		}
+		if (t->cb != NULL) {
+			t->cb();
+		}
+	}
+	timer_arm();
+}
+
+/* Call cb after delay ticks, then every period ticks unless period is 0.
+ * Restarts the slot if it is running already. */
+void timer_start(const uint8_t slot, const uint32_t delay, const uint32_t period,
+                 timer_callback_t cb)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		g_timer.slot[slot].due = clock_now() + delay;
+		g_timer.slot[slot].period = period;
+		g_timer.slot[slot].cb = cb;
+		g_timer.running |= (1 << slot);
+		timer_arm();
+	}
+}
+
+void timer_cancel(const uint8_t slot)
+{
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		g_timer.running &= ~(1 << slot);
+		timer_arm();
+	}
+}
+
+uint8_t timer_pending(const uint8_t slot)
+{
+	uint8_t ret = 0;
+
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+		ret = (g_timer.running & (1 << slot)) ? 1 : 0;
+	}
+	return ret;
+}
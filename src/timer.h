@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include "clock.h"
+
+/* Software timers on Timer 1 compare B
+ *
+ * Every user owns a slot, so starting and cancelling a timer is O(1). The
+ * compare register is programmed to the earliest deadline of all running
+ * slots (no periodic tick), the interrupt is off while none is running.
+ * Callbacks run in interrupt context: keep them short, post an event for
+ * anything else. Delays must be shorter than 2^31 ticks (~17 minutes).
+ */
+
+enum timer_slot {
+	TIMER_SLOT_WDT = 0, /* wdt_schedule() compatibility */
+	TIMER_SLOT_LED,     /* LED pattern tick */
+	TIMER_SLOT_HOLD,    /* held IR key released */
+	TIMER_SLOT_PGA,     /* PGA write rate limit */
+	TIMER_SLOT_FADE,    /* gain fade tick */
+	TIMER_SLOTS,
+};
+
+/*! Milliseconds to Timer 1 ticks */
+#define TIMER_MS(ms) ((uint32_t)(ms) * CLOCK_TICKS_PER_MS)
+/*! Microseconds to Timer 1 ticks */
+#define TIMER_US(us) ((uint32_t)(us) * CLOCK_TICKS_PER_MS / 1000)
+
+typedef void (*timer_callback_t)(void);
+
+void timer_start(const uint8_t slot, const uint32_t delay, const uint32_t period,
+                 timer_callback_t cb);
+void timer_cancel(const uint8_t slot);
+uint8_t timer_pending(const uint8_t slot);
@@ -15,3 +15,14 @@
         sleep_cpu(); \
         sleep_disable(); \
 } while (0)
+
+/* Call with interrupts disabled after checking there is nothing to do:
+ * the instruction after sei() is always executed, so an interrupt that
+ * became pending after the check wakes the CPU instead of being missed. */
+#define IDLE_MCU_LOCKED() do { \
+        sleep_enable(); \
+        set_sleep_mode(SLEEP_MODE_IDLE); \
+        sei(); \
+        sleep_cpu(); \
+        sleep_disable(); \
+} while (0)
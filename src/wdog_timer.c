@@ -1,59 +1,41 @@
+/* Watch Dog Timer Interface */
 #include "wdog_timer.h"
+#include "timer.h"
 #include <stdlib.h>
+#include <avr/pgmspace.h>
 #include <util/atomic.h>
 
-/* Watch Dog Timer Implementation */
-
-#define WDT_CONFIG_MASK (_BV(WDIE) | _BV(WDE))
-
-#define wdt_config_locked(config,value) \
-__asm__ __volatile__ ( \
-	"wdr" "\n\t" \
-	"sts %0,%1" "\n\t" \
-	"sts %0,%2" "\n\t" \
- \
-	: /* no outputs */ \
-	: "M" (_SFR_MEM_ADDR(_WD_CONTROL_REG)), \
-	"r" (_BV(_WD_CHANGE_BIT) | _BV(WDE)), \
-	"r" ((uint8_t) ((value & 0x08 ? _WD_PS3_MASK : 0x00) | \
-             (config & WDT_CONFIG_MASK) | (value & 0x07)) ) \
-	: "r0" \
-)
-
-#define WDT_STATE_OFF 0
-#define WDT_STATE_RUNNING 1
+/* Watch Dog Timer Implementation
+ *
+ * The watchdog itself is only used to reset into the bootloader. The
+ * scheduling calls are kept for existing users and map onto the
+ * TIMER_SLOT_WDT software timer (see timer.h): a callback after
+ * (count + 1) periods of the wdto prescaler setting, one at a time.
+ */
+
+/* Watchdog periods in ms, indexed by WDTO_* */
+static const uint16_t wdt_period_ms[] PROGMEM = {
+	15, 30, 60, 120, 250, 500, 1000, 2000, 4000, 8000,
+};
 
+/* Longest delay the software timers handle (2^31 ticks) */
+#define WDT_MAX_MS (0x7fffffffUL / CLOCK_TICKS_PER_MS)
 
 static volatile uint16_t *bootKeyPtr = (volatile uint16_t *)0x0800;
 
-static struct {
-	volatile uint16_t counter;
-	volatile uint8_t state;
-	volatile wdt_callback_t callback;
-} wdt_state = {
-	.counter = 0,
-	.state = WDT_STATE_OFF,
-	.callback = NULL,
-};
+static uint32_t wdt_delay (uint8_t wdto, uint16_t count);
 
-static void clear_wdt_irq (void);
-
-static void clear_wdt_irq (void)
+static uint32_t wdt_delay (uint8_t wdto, uint16_t count)
 {
-	WDTCSR |= _BV(WDIF); /* clear irq */
-}
+	uint32_t ms;
 
-ISR(WDT_vect)
-{
-	if (wdt_state.counter == 0) {
-		wdt_config_locked(0, 0);
-		wdt_state.state = WDT_STATE_OFF;
-		if (wdt_state.callback != NULL) {
-			wdt_state.callback();
-		}
-	} else {
-		--wdt_state.counter;
-	}
+	if (wdto >= (sizeof(wdt_period_ms) / sizeof(wdt_period_ms[0])))
+		wdto = WDTO_8S;
+	ms = (uint32_t)pgm_read_word(&wdt_period_ms[wdto]) * (count + 1UL);
+	if (ms > WDT_MAX_MS)
+		ms = WDT_MAX_MS;
+
+	return TIMER_MS(ms);
 }
 
 void wdt_enter_bootloader (void)
@@ -68,13 +50,12 @@ void wdt_enter_bootloader (void)
 
 int8_t wdt_schedule (uint8_t wdto, uint16_t count, wdt_callback_t cb)
 {
+	uint32_t delay = wdt_delay(wdto, count);
+
 	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		if (wdt_state.state != WDT_STATE_OFF)
+		if (timer_pending(TIMER_SLOT_WDT))
 			return -EBUSY;
-	        wdt_state.counter = count;
-		wdt_state.callback = cb;
-		wdt_state.state = WDT_STATE_RUNNING;
-		wdt_config_locked(_BV(WDIE), wdto);
+		timer_start(TIMER_SLOT_WDT, delay, 0, cb);
 	}
 
 	return 0;
@@ -82,34 +63,15 @@ int8_t wdt_schedule (uint8_t wdto, uint16_t count, wdt_callback_t cb)
 
 void wdt_schedule_replace (uint8_t wdto, uint16_t count, wdt_callback_t cb)
 {
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		wdt_state.counter = count;
-		wdt_state.callback = cb;
-		wdt_state.state = WDT_STATE_RUNNING;
-		wdt_config_locked(0, 0);
-		clear_wdt_irq();
-		wdt_config_locked(_BV(WDIE), wdto);
-	}
+	timer_start(TIMER_SLOT_WDT, wdt_delay(wdto, count), 0, cb);
 }
 
 void wdt_cancel (void)
 {
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		wdt_state.counter = 0;
-		wdt_state.callback = NULL;
-		wdt_state.state = WDT_STATE_OFF;
-		wdt_config_locked(0, 0);
-		clear_wdt_irq();
-	}
+	timer_cancel(TIMER_SLOT_WDT);
 }
 
 uint8_t wdt_running (void)
 {
-	uint8_t ret = 0;
-	ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-		ret  = (wdt_state.state == WDT_STATE_RUNNING) ?
-			1 : 0;
-	}
-
-	return ret;
+	return timer_pending(TIMER_SLOT_WDT);
 }